@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Alloc.h"
+#include "error.h"
+
+static long total[AL_MODULES];
+static long start[AL_MODULES]; // totals when the current line began
+static long last[AL_MODULES];  // allocations of the line before
+static long reused[AL_MODULES];
+
+// Freed blocks, one list per GRAIN-byte size class, linked through the blocks themselves
+#define GRAIN 16
+#define CLASSES 16 // blocks up to 256 bytes are recycled
+#define KEEP 64    // most blocks kept per class
+typedef struct
+{
+  void *free;
+  int n;
+} Pool;
+static Pool pool[CLASSES];
+
+// Steady-state check: the line before, and how many times in a row it has run
+static int warm = -1;
+static char prev[256];
+static int repeats = 0;
+
+extern void *mallocAlloc(int module, size_t n)
+{
+  total[module]++;
+  return malloc(n);
+}
+
+extern void *callocAlloc(int module, size_t n, size_t size)
+{
+  total[module]++;
+  return calloc(n, size);
+}
+
+extern void *reallocAlloc(int module, void *p, size_t n)
+{
+  total[module]++;
+  return realloc(p, n);
+}
+
+extern char *strdupAlloc(int module, const char *s)
+{
+  total[module]++;
+  return strdup(s);
+}
+
+extern char *strndupAlloc(int module, const char *s, size_t n)
+{
+  total[module]++;
+  return strndup(s, n);
+}
+
+// Size class of a block of size bytes, CLASSES if it is too big to recycle
+static int sizeclass(size_t size)
+{
+  int c = size ? (size - 1) / GRAIN : 0;
+  return c < CLASSES ? c : CLASSES;
+}
+
+extern void *newAlloc(int module, size_t size)
+{
+  int c = sizeclass(size);
+  if (c < CLASSES && pool[c].free)
+  {
+    void *p = pool[c].free;
+    pool[c].free = *(void **)p;
+    pool[c].n--;
+    reused[module]++;
+    return p;
+  }
+  total[module]++;
+  return malloc(c < CLASSES ? (c + 1) * GRAIN : size);
+}
+
+extern void freeAlloc(void *p, size_t size)
+{
+  if (!p)
+    return;
+  int c = sizeclass(size);
+  if (c == CLASSES || pool[c].n == KEEP)
+  {
+    free(p);
+    return;
+  }
+  *(void **)p = pool[c].free;
+  pool[c].free = p;
+  pool[c].n++;
+}
+
+extern char *dupAlloc(int module, const char *s, size_t n)
+{
+  n = strnlen(s, n);
+  char *d = newAlloc(module, n + 1);
+  if (d)
+  {
+    memcpy(d, s, n);
+    d[n] = 0;
+  }
+  return d;
+}
+
+extern void freedupAlloc(char *s)
+{
+  if (s)
+    freeAlloc(s, strlen(s) + 1);
+}
+
+extern void lineAlloc(const char *line)
+{
+  long n = 0;
+  for (int m = 0; m < AL_MODULES; m++)
+  {
+    last[m] = total[m] - start[m];
+    start[m] = total[m];
+    n += last[m];
+  }
+  if (warm < 0)
+    return;
+  if (*prev && repeats >= warm && n)
+  {
+    printAlloc(stderr);
+    ERROR("%s: %ld allocations after %d runs", prev, n, repeats);
+  }
+  // Lines too long to keep are never checked
+  if (strlen(line) < sizeof(prev) && !strcmp(line, prev))
+    repeats++;
+  else
+  {
+    repeats = 0;
+    snprintf(prev, sizeof(prev), "%s", strlen(line) < sizeof(prev) ? line : "");
+  }
+}
+
+extern void checkAlloc(int warmup)
+{
+  warm = warmup;
+  repeats = 0;
+  prev[0] = 0;
+}
+
+extern void printAlloc(FILE *f)
+{
+  static const char *modules[] = {"Scanner", "Parser", "Tree", "Command", "Pipeline", "deq"};
+  fprintf(f, "%-10s %10s %10s %10s\n", "module", "mallocs", "last line", "reused");
+  for (int m = 0; m < AL_MODULES; m++)
+    fprintf(f, "%-10s %10ld %10ld %10ld\n", modules[m], total[m], last[m], reused[m]);
+}
+
+// Frees the blocks kept in a set of pools
+static void drain(Pool *pools)
+{
+  for (int c = 0; c < CLASSES; c++)
+  {
+    while (pools[c].free)
+    {
+      void *p = pools[c].free;
+      pools[c].free = *(void **)p;
+      free(p);
+    }
+    pools[c].n = 0;
+  }
+}
+
+extern void freestateAlloc()
+{
+  drain(pool);
+}
+
+// What swapAlloc() saves of the state above
+typedef struct
+{
+  long total[AL_MODULES];
+  long start[AL_MODULES];
+  long last[AL_MODULES];
+  long reused[AL_MODULES];
+  Pool pool[CLASSES];
+  int warm;
+  char prev[256];
+  int repeats;
+} *AllocState;
+
+extern void *swapAlloc(void *state)
+{
+  AllocState old = malloc(sizeof(*old));
+  if (!old)
+    ERROR("malloc() failed");
+  memcpy(old->total, total, sizeof(total));
+  memcpy(old->start, start, sizeof(start));
+  memcpy(old->last, last, sizeof(last));
+  memcpy(old->reused, reused, sizeof(reused));
+  memcpy(old->pool, pool, sizeof(pool));
+  old->warm = warm;
+  memcpy(old->prev, prev, sizeof(prev));
+  old->repeats = repeats;
+  AllocState s = state;
+  if (!s)
+  {
+    if (!(s = calloc(1, sizeof(*s))))
+      ERROR("calloc() failed");
+    s->warm = -1;
+  }
+  memcpy(total, s->total, sizeof(total));
+  memcpy(start, s->start, sizeof(start));
+  memcpy(last, s->last, sizeof(last));
+  memcpy(reused, s->reused, sizeof(reused));
+  memcpy(pool, s->pool, sizeof(pool));
+  warm = s->warm;
+  memcpy(prev, s->prev, sizeof(prev));
+  repeats = s->repeats;
+  free(s);
+  return old;
+}
+
+extern void dropAlloc(void *state)
+{
+  AllocState s = state;
+  drain(s->pool);
+  free(s);
+}
@@ -0,0 +1,136 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Allocation accounting
+ *
+ * A module that defines ALLOC_MODULE before including this header has
+ * its malloc(), calloc(), realloc(), strdup() and strndup() calls
+ * counted against it. Counts are kept in total and for the last command
+ * line, in the shell process only (a child's allocations are its own).
+ *
+ * Objects made and freed for every line (scanner tokens, tree nodes,
+ * commands, deq nodes...) come from newAlloc(), which recycles freed
+ * blocks of the same size class instead of going back to malloc(), so
+ * once the shell has run a command, running it again costs no heap
+ * allocations. Only malloc() calls are counted, reuse is shown apart.
+ *
+ * Steady-state check: once set, a line run again (the same text as the
+ * line before it) more than a number of times in a row must not
+ * allocate at all in the counted modules. If it does, the shell reports
+ * the line and exits with a failure, so a test that runs a simple
+ * command repeatedly fails when allocations creep into its path.
+ */
+
+// Modules counted
+enum
+{
+  AL_SCANNER,
+  AL_PARSER,
+  AL_TREE,
+  AL_COMMAND,
+  AL_PIPELINE,
+  AL_DEQ,
+  AL_MODULES
+};
+
+extern void *mallocAlloc(int module, size_t n);
+extern void *callocAlloc(int module, size_t n, size_t size);
+extern void *reallocAlloc(int module, void *p, size_t n);
+extern char *strdupAlloc(int module, const char *s);
+extern char *strndupAlloc(int module, const char *s, size_t n);
+
+/**
+ * @brief Gets a block, recycled if one of its size class was freed
+ * @param module Module to count a malloc() against
+ * @param size Bytes needed
+ * @return The block, or NULL if malloc() failed
+ */
+extern void *newAlloc(int module, size_t size);
+
+/**
+ * @brief Gives back a block from newAlloc(), for reuse
+ *
+ * size may be less than was asked for (a string that was shortened),
+ * never more. Blocks from anything but newAlloc() must not be given.
+ *
+ * @param p Block, or NULL
+ * @param size Bytes asked for, or fewer
+ * @return VOID
+ */
+extern void freeAlloc(void *p, size_t size);
+
+/**
+ * @brief Copies at most n characters of a string into a block from newAlloc()
+ * @return The copy, or NULL if malloc() failed
+ */
+extern char *dupAlloc(int module, const char *s, size_t n);
+
+/**
+ * @brief Gives back a string from dupAlloc() (or newAlloc())
+ * @param s String, or NULL
+ * @return VOID
+ */
+extern void freedupAlloc(char *s);
+
+/**
+ * @brief Marks the start of a command line
+ *
+ * Closes the count for the line before, and checks it if the
+ * steady-state check is on.
+ *
+ * @param line Text of the line
+ * @return VOID
+ */
+extern void lineAlloc(const char *line);
+
+/**
+ * @brief Turns the steady-state check on or off
+ * @param warmup Times a line may repeat, allocating, before it must not; < 0 for off
+ * @return VOID
+ */
+extern void checkAlloc(int warmup);
+
+/**
+ * @brief Prints the counts per module, in total and for the last line
+ * @param f Stream to print to
+ * @return VOID
+ */
+extern void printAlloc(FILE *f);
+
+/**
+ * @brief Frees the blocks kept for reuse
+ * @return VOID
+ */
+extern void freestateAlloc();
+
+/**
+ * @brief Switches to another session's counts, check and recycled blocks
+ * @param state State returned by an earlier swapAlloc(), or NULL for a
+ *              new one (no counts, no blocks, check off); it is taken over
+ * @return The state that was in use
+ */
+extern void *swapAlloc(void *state);
+
+/**
+ * @brief Frees state returned by swapAlloc(), with its recycled blocks
+ * @param state State to free
+ * @return VOID
+ */
+extern void dropAlloc(void *state);
+
+#ifdef ALLOC_MODULE
+#undef strdup
+#undef strndup
+#define malloc(n) mallocAlloc(ALLOC_MODULE, n)
+#define calloc(n, size) callocAlloc(ALLOC_MODULE, n, size)
+#define realloc(p, n) reallocAlloc(ALLOC_MODULE, p, n)
+#define strdup(s) strdupAlloc(ALLOC_MODULE, s)
+#define strndup(s, n) strndupAlloc(ALLOC_MODULE, s, n)
+#endif
+
+#endif
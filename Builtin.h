@@ -0,0 +1,49 @@
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+/**
+ * ABI for builtins loaded from a shared object with enable -f
+ *
+ * A library provides each builtin as a ShellBuiltin named
+ * shell_builtin_NAME, most easily with the SHELL_BUILTIN macro:
+ *
+ *   static int hello(int argc, char **argv, int in, int out, int err)
+ *   {
+ *     dprintf(out, "hello %s\n", argc > 1 ? argv[1] : "world");
+ *     return 0;
+ *   }
+ *   SHELL_BUILTIN(hello, hello, "hello [name]");
+ *
+ * and is built with gcc -shared -fPIC. "enable -f lib.so hello" then
+ * runs hello in the shell process, like the builtins compiled in. The
+ * library only depends on this header, not on the shell's internals.
+ *
+ * BUILTIN_ABI changes whenever ShellBuiltin or the meaning of its
+ * fields does; a library built for another version is refused.
+ */
+
+#define BUILTIN_ABI 1
+
+typedef struct
+{
+  int abi;           // BUILTIN_ABI the library was built with
+  const char *name;  // command name
+  const char *usage; // one line, for messages
+  /**
+   * Runs the builtin
+   *
+   * @param argc  Number of arguments, including the name
+   * @param argv  Arguments after expansion, argv[0] is the name, argv[argc] is NULL
+   * @param in    File descriptor to read input from
+   * @param out   File descriptor to write output to
+   * @param err   File descriptor to write errors to
+   *
+   * @return Exit status
+   */
+  int (*run)(int argc, char **argv, int in, int out, int err);
+} ShellBuiltin;
+
+#define SHELL_BUILTIN(name, run, usage) \
+  const ShellBuiltin shell_builtin_##name = {BUILTIN_ABI, #name, usage, run}
+
+#endif
@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <string.h>
+#include <libgen.h>
+
+#include "../Builtin.h"
+
+/**
+ * basename and dirname as loadable builtins (enable -f Builtins/libpath.so basename dirname)
+ *
+ * Both are run constantly by scripts to take paths apart, and each one
+ * would otherwise be a fork and exec for a few bytes of output.
+ */
+
+static int path(int argc, char **argv, int out, int err, char *(*part)(char *))
+{
+  if (argc < 2)
+  {
+    dprintf(err, "usage: %s path...\n", argv[0]);
+    return 1;
+  }
+  for (int i = 1; i < argc; i++)
+  {
+    // Both may modify their argument
+    char buf[4096];
+    snprintf(buf, sizeof(buf), "%s", argv[i]);
+    dprintf(out, "%s\n", part(buf));
+  }
+  return 0;
+}
+
+static int basename_run(int argc, char **argv, int in, int out, int err)
+{
+  return path(argc, argv, out, err, basename);
+}
+
+static int dirname_run(int argc, char **argv, int in, int out, int err)
+{
+  return path(argc, argv, out, err, dirname);
+}
+
+SHELL_BUILTIN(basename, basename_run, "basename path...");
+SHELL_BUILTIN(dirname, dirname_run, "dirname path...");
@@ -0,0 +1,412 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memfd_create(), pipe2()
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "Capture.h"
+#include "error.h"
+
+// Bytes of a job's output kept in memory, the older ones spill to a memory file
+#define RING (1 << 16)
+
+// Modes, as capture takes them
+static char *modes[] = {"off", "launch", "completion", 0};
+enum
+{
+  OFF,
+  LAUNCH,
+  COMPLETION
+};
+
+// Output of one background job
+typedef struct Job
+{
+  int id;
+  int owner;    // session whose job it is
+  int fd;       // read end of the job's pipe, -1 once all of it is read
+  char *ring;   // RING bytes (once there is output), len of them in use from head
+  size_t head;
+  size_t len;
+  int spill;    // memory file with the output older than the ring's, or -1
+  long done;    // when all of it was read (1, 2, ...), 0 until then
+  struct Job *next;
+} *Job;
+
+// Shared with the capture thread, under lock. The thread only uses plain
+// malloc(), never the shell's own modules (deq, Alloc), which aren't thread-safe
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ended = PTHREAD_COND_INITIALIZER;
+static pthread_t worker;
+static int started = 0;
+static int stop = 0;
+static int wake = -1;    // eventfd: a job was added, or stop changed
+static Job jobs = 0;     // in the order started
+static int ids = 0;      // number of the last capture made
+static long finished = 0; // jobs whose output has all been read
+static int mode = OFF;
+static int owner = 0;  // session running, 0 for the shell's own
+static int owners = 0; // number of the last session
+
+extern int setCapture(char *m)
+{
+  for (int i = 0; modes[i]; i++)
+    if (!strcmp(m, modes[i]))
+    {
+      mode = i;
+      return 0;
+    }
+  return -1;
+}
+
+extern void printCapture(FILE *f)
+{
+  fprintf(f, "%s\n", modes[mode]);
+}
+
+/**
+ * @brief Adds output to a job's ring, spilling its oldest bytes when full
+ */
+static void keep(Job j, char *buf, size_t n)
+{
+  if (!j->ring && !(j->ring = malloc(RING)))
+    ERROR("malloc() failed");
+  while (n)
+  {
+    if (j->len == RING)
+    {
+      // Full: from head to the end of the ring is the oldest part
+      size_t k = RING - j->head;
+      if (j->spill == -1 && (j->spill = memfd_create("capture", MFD_CLOEXEC)) == -1)
+        ERROR("memfd_create() failed");
+      if (write(j->spill, j->ring + j->head, k) != (ssize_t)k)
+        ERROR("write() to memory file failed");
+      j->head = 0;
+      j->len -= k;
+    }
+    size_t at = (j->head + j->len) % RING;
+    size_t k = RING - j->len;
+    if (k > RING - at)
+      k = RING - at;
+    if (k > n)
+      k = n;
+    memcpy(j->ring + at, buf, k);
+    j->len += k;
+    buf += k;
+    n -= k;
+  }
+}
+
+/**
+ * @brief The capture thread: reads every job's pipe into its ring
+ */
+static void *work(void *arg)
+{
+  char buf[1 << 16];
+  struct pollfd *p = 0;
+  Job *at = 0; // job of each entry of p
+  int size = 0;
+  for (;;)
+  {
+    pthread_mutex_lock(&lock);
+    if (stop)
+    {
+      pthread_mutex_unlock(&lock);
+      free(p);
+      free(at);
+      return 0;
+    }
+    int n = 1;
+    for (Job j = jobs; j; j = j->next)
+      n += j->fd != -1;
+    if (n > size)
+    {
+      size = n * 2;
+      p = realloc(p, sizeof(*p) * size);
+      at = realloc(at, sizeof(*at) * size);
+      if (!p || !at)
+        ERROR("realloc() failed");
+    }
+    p[0].fd = wake;
+    p[0].events = POLLIN;
+    n = 1;
+    for (Job j = jobs; j; j = j->next)
+      if (j->fd != -1)
+      {
+        at[n] = j;
+        p[n].fd = j->fd;
+        p[n++].events = POLLIN;
+      }
+    pthread_mutex_unlock(&lock);
+
+    // Jobs still being read are only freed once they aren't, so at[] stays valid
+    while (poll(p, n, -1) == -1)
+      ;
+    if (p[0].revents)
+    {
+      unsigned long long k;
+      while (read(wake, &k, sizeof(k)) == -1 && errno == EINTR)
+        ;
+    }
+    for (int i = 1; i < n; i++)
+    {
+      if (!p[i].revents)
+        continue;
+      ssize_t r = read(p[i].fd, buf, sizeof(buf));
+      if (r == -1 && errno == EINTR)
+        continue;
+      pthread_mutex_lock(&lock);
+      if (r > 0)
+        keep(at[i], buf, r);
+      else
+      {
+        // Every stage has exited (or closed its output)
+        close(at[i]->fd);
+        at[i]->fd = -1;
+        at[i]->done = ++finished;
+        pthread_cond_broadcast(&ended);
+      }
+      pthread_mutex_unlock(&lock);
+    }
+  }
+}
+
+// Wakes the capture thread up to look at jobs and stop
+static void poke()
+{
+  unsigned long long one = 1;
+  while (write(wake, &one, sizeof(one)) == -1 && errno == EINTR)
+    ;
+}
+
+// fork() while the thread holds lock would leave the child's copy locked for good
+static void forking() { pthread_mutex_lock(&lock); }
+static void forked() { pthread_mutex_unlock(&lock); }
+
+// A forked child has no capture thread, and the jobs captured are its parent's to write out
+static void child()
+{
+  started = 0;
+  jobs = 0;
+  close(wake);
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Starts the capture thread, with lock held
+ */
+static void start()
+{
+  static int atfork = 0;
+  if (!atfork++)
+    pthread_atfork(forking, forked, child);
+  // Signals are for the shell's own thread
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  wake = eventfd(0, EFD_CLOEXEC);
+  if (wake == -1 || pthread_create(&worker, 0, work, 0))
+    ERROR("can't start the output capture");
+  pthread_sigmask(SIG_SETMASK, &old, 0);
+  started = 1;
+}
+
+extern int newCapture(int *fd)
+{
+  *fd = -1;
+  if (mode == OFF)
+    return 0;
+  int p[2];
+  if (pipe2(p, O_CLOEXEC) == -1)
+    ERROR("pipe2() failed");
+  Job j = calloc(1, sizeof(*j));
+  if (!j)
+    ERROR("calloc() failed");
+  j->fd = p[0];
+  j->spill = -1;
+
+  pthread_mutex_lock(&lock);
+  if (!started)
+    start();
+  j->id = ++ids;
+  j->owner = owner;
+  Job *last = &jobs;
+  while (*last)
+    last = &(*last)->next;
+  *last = j;
+  poke();
+  pthread_mutex_unlock(&lock);
+  *fd = p[1];
+  return j->id;
+}
+
+extern void childCapture(int fd, int out)
+{
+  if (fd == -1)
+    return;
+  if ((out && dup2(fd, STDOUT_FILENO) == -1) || dup2(fd, STDERR_FILENO) == -1)
+    ERROR("dup2() failed");
+  close(fd);
+}
+
+// Writes all of buf to stdout
+static void put(char *buf, size_t n)
+{
+  while (n)
+  {
+    ssize_t r = write(STDOUT_FILENO, buf, n);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return;
+    buf += r;
+    n -= r;
+  }
+}
+
+/**
+ * @brief Writes a job's output to stdout: the memory file, then the ring
+ */
+static void show(Job j)
+{
+  if (!j->ring)
+    return;
+  if (j->spill != -1)
+  {
+    char buf[1 << 16];
+    off_t off = 0;
+    ssize_t r;
+    while ((r = pread(j->spill, buf, sizeof(buf), off)) > 0)
+    {
+      put(buf, r);
+      off += r;
+    }
+  }
+  size_t k = RING - j->head < j->len ? RING - j->head : j->len;
+  put(j->ring + j->head, k);
+  put(j->ring, j->len - k);
+}
+
+extern int outputCapture(int id)
+{
+  pthread_mutex_lock(&lock);
+  Job j = jobs;
+  while (j && j->id != id)
+    j = j->next;
+  if (j)
+  {
+    fflush(stdout);
+    show(j);
+  }
+  pthread_mutex_unlock(&lock);
+  return j ? 0 : -1;
+}
+
+extern int onCapture()
+{
+  pthread_mutex_lock(&lock);
+  int on = mode != OFF;
+  for (Job j = jobs; j && !on; j = j->next)
+    on = j->owner == owner;
+  pthread_mutex_unlock(&lock);
+  return on;
+}
+
+extern void flushCapture()
+{
+  if (!started)
+    return;
+  fflush(stdout);
+  for (;;)
+  {
+    // Next one due: the first started, or the first done, if it is done
+    pthread_mutex_lock(&lock);
+    Job *due = 0;
+    for (Job *j = &jobs; *j; j = &(*j)->next)
+    {
+      if ((*j)->owner != owner)
+        continue;
+      if ((*j)->done && (!due || (*j)->done < (*due)->done))
+        due = j;
+      if (mode != COMPLETION)
+        break;
+    }
+    Job j = due && (*due)->done ? *due : 0;
+    if (j)
+      *due = j->next;
+    pthread_mutex_unlock(&lock);
+    if (!j)
+      return;
+    // Out of the list and read to the end, the thread won't touch it again
+    show(j);
+    if (j->spill != -1)
+      close(j->spill);
+    free(j->ring);
+    free(j);
+  }
+}
+
+extern void endCapture()
+{
+  if (!started)
+    return;
+  pthread_mutex_lock(&lock);
+  for (;;)
+  {
+    Job j = jobs;
+    while (j && (j->done || j->owner != owner))
+      j = j->next;
+    if (!j)
+      break;
+    pthread_cond_wait(&ended, &lock);
+  }
+  pthread_mutex_unlock(&lock);
+  flushCapture();
+}
+
+extern void freeCapture()
+{
+  if (!started)
+    return;
+  endCapture();
+
+  pthread_mutex_lock(&lock);
+  stop = 1;
+  pthread_mutex_unlock(&lock);
+  poke();
+  pthread_join(worker, 0);
+  close(wake);
+  started = stop = 0;
+}
+
+// What swapCapture() saves of the state above
+typedef struct
+{
+  int mode;
+  int owner;
+} *CaptureState;
+
+extern void *swapCapture(void *state)
+{
+  CaptureState old = malloc(sizeof(*old));
+  if (!old)
+    ERROR("malloc() failed");
+  CaptureState s = state;
+  pthread_mutex_lock(&lock);
+  old->mode = mode;
+  old->owner = owner;
+  mode = s ? s->mode : OFF;
+  owner = s ? s->owner : ++owners;
+  pthread_mutex_unlock(&lock);
+  free(s);
+  return old;
+}
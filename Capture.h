@@ -0,0 +1,106 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+
+/**
+ * Ordered output capture for background jobs
+ *
+ *   capture [launch | completion | off]   sets (or shows) the mode
+ *   jobs                                  lists the background jobs
+ *   jobs -o %N                            shows job N's output so far
+ *
+ * Off by default. Otherwise the stdout and stderr of every stage of a
+ * background pipeline go down one pipe, read by a thread of the shell
+ * into a ring buffer of the job's own. When the ring is full its oldest
+ * bytes spill to a memory file (memfd), so memory stays bounded however
+ * much the job writes. A job's output is written out whole, to the
+ * shell's stdout, once it has all been read (every stage has exited), as
+ * jobs are reaped: in the order the jobs were started (launch), or the
+ * order they finished (completion). Output is never interleaved, but a
+ * started job holds back the jobs after it in launch order.
+ *
+ * Redirections of a stage still apply over the capture. Each session
+ * (Session.h) has its own mode and writes out only its own jobs; one
+ * thread reads for all of them. A shell that exits waits for the jobs it
+ * is capturing, to write their output out.
+ */
+
+/**
+ * @brief Sets the capture mode
+ * @param mode "launch", "completion" or "off"
+ * @return 0, or -1 if mode isn't one of those
+ */
+extern int setCapture(char *mode);
+
+/**
+ * @brief Prints the capture mode, as capture takes it
+ * @param f Stream to print to
+ * @return VOID
+ */
+extern void printCapture(FILE *f);
+
+/**
+ * @brief Starts capturing the output of a background job about to be forked
+ *
+ * The job's children put *fd on their stdout (if it isn't a pipe to the
+ * next stage) and stderr, see childCapture(); the shell closes it once
+ * they have all been forked.
+ *
+ * @param fd Set to the write end of the job's pipe, -1 if capture is off
+ * @return Number of the capture, 0 if capture is off
+ */
+extern int newCapture(int *fd);
+
+/**
+ * @brief Sends a forked child's output to its job's capture
+ * @param fd Write end from newCapture(), or -1 for none
+ * @param out Non-zero for stdout as well as stderr
+ * @return VOID
+ */
+extern void childCapture(int fd, int out);
+
+/**
+ * @brief Writes a job's output so far to stdout, leaving it captured
+ * @param id Number of the capture
+ * @return 0, or -1 if there is no such capture (or it was written out)
+ */
+extern int outputCapture(int id);
+
+/**
+ * @brief Writes out the output of the jobs that are done, in the mode's order
+ * @return VOID
+ */
+extern void flushCapture();
+
+/**
+ * @brief Whether output is being captured: the mode is on, or a job's output is still held
+ *
+ * While it is, the shell can't exec its last command in its own place,
+ * or the output it holds would be lost.
+ *
+ * @return Non-zero if so
+ */
+extern int onCapture();
+
+/**
+ * @brief Waits for the jobs captured for the current session and writes their output out
+ * @return VOID
+ */
+extern void endCapture();
+
+/**
+ * @brief Waits for the jobs captured, writes their output out and stops the thread
+ * @return VOID
+ */
+extern void freeCapture();
+
+/**
+ * @brief Switches to another session's capture mode and jobs
+ * @param state State returned by an earlier swapCapture(), or NULL for a
+ *              new session's (off, no jobs); it is taken over
+ * @return The state that was in use, freed with free()
+ */
+extern void *swapCapture(void *state);
+
+#endif
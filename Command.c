@@ -1,36 +1,97 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memfd_create(), pipe2()
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/wait.h>
-#include <readline/history.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <dlfcn.h>
+#include <pthread.h>
 #include "Command.h"
+#include "Builtin.h"
+#include "Vars.h"
+#include "Glob.h"
+#include "History.h"
+#include "Pin.h"
+#include "Prio.h"
+#include "Xargs.h"
+#include "Stats.h"
+#include "Complete.h"
+#include "Deadline.h"
+#include "Capture.h"
+#include "Meter.h"
+#include "Coproc.h"
+#include "Results.h"
+#include "Control.h"
+#define ALLOC_MODULE AL_COMMAND
+#include "Alloc.h"
 #include "error.h"
 #include "deq.h"
 
+extern char **environ;
+
 /**
  * CommandRep - Internal representation of a Command
  *
  * This struct holds the informatin to execute a command:
+ * - words: The words as parsed, before expansion ["X=1", "ls", "$D"]
  * - file: The name of the program to execute (ls)
- * - argv: Array of argument strings ["ls","-l"]
- *         argv[0] is always the program name
+ * - argv: Array of argument strings ["ls","-l"], built from words by
+ *         getargs() each time the command runs. argv[0] is always the
+ *         program name, or NULL if the command is only assignments
+ * - input/output: Redirection file names (< and >), or descriptors (<&, >&)
+ * - dupin/dupout: input/output is a descriptor
+ * - here: Here-document or here-string body fed to stdin
+ * - group: Pipelines of a { } or ( ) group, in place of words
+ * - control: An if, while or for, in place of words
+ * - substs: Process substitutions among the words, or NULL
  */
 typedef struct
 {
+  char **words;
   char *file;
   char **argv;
   char *input;
   char *output;
+  int dupin;
+  int dupout;
+  char *here;
+  Sequence group;
+  int subshell;
+  Control control;
+  Deq substs;
 } *CommandRep;
 
+/**
+ * A process substitution, <( sequence ) or >( sequence ), among a command's words
+ *
+ * - word: Its index in words, where it is "<(" or ">("
+ * - out: >(: the sequence reads what the command writes
+ * - arg: Its index in argv, once expanded by getargs()
+ * - fd: The command's end of the pipe while it runs, or -1
+ */
+typedef struct
+{
+  int word;
+  int out;
+  Sequence sequence;
+  int arg;
+  int fd;
+} *Subst;
+
 // Macro Definitions for Builtin Commands
 #define BIARGS CommandRep r, int *eof, Jobs jobs      // Set built in number of arguments
 #define BINAME(name) bi_##name                        // set the name of built in
-#define BIDEFN(name) static void BINAME(name)(BIARGS) // define built in
+#define BIDEFN(name) static int BINAME(name)(BIARGS)  // define built in, returns its exit status
 #define BIENTRY(name) {#name, BINAME(name)}           // ??
 
+// Report an error without exiting, for failures inside the shell process
+#define WARNING(s) ERRORLOC(__FILE__, __LINE__, "error", "%s", s)
+
 // Old working directory
 static char *owd = 0;
 // Current working directory
@@ -38,6 +99,39 @@ static char *cwd = 0;
 // Queue to track all background process
 static Deq background_pids = NULL;
 
+// Set by a program that runs sessions (Session.h): the shell is its library
+static void (*idler)(int waiting) = 0;
+// The shell's stdin/stdout are redirected in-process, so no other session may run
+static int held = 0;
+
+// A forked child is a process of its own, with no other session to make way for
+static void unhost() { idler = 0; }
+
+extern void hostCommand(void (*idle)(int waiting))
+{
+  if (!idler)
+    pthread_atfork(0, 0, unhost);
+  idler = idle;
+}
+
+extern void idleCommand(int waiting)
+{
+  if (idler && !held)
+    idler(waiting);
+}
+
+/**
+ * Ends a forked child
+ *
+ * Not exit(): the atexit() handlers, and whatever the stdio buffers held
+ * when it was forked, are the shell's (or its host program's) alone.
+ */
+static void quit(int status)
+{
+  fflush(stdout);
+  _exit(status);
+}
+
 /**
  *
  * Reap any terminated background process
@@ -47,6 +141,8 @@ static Deq background_pids = NULL;
  */
 extern void reap_background_processes()
 {
+  // Output of the jobs that are done goes out whole, in the capture mode's order
+  flushCapture();
   if (!background_pids || deq_len(background_pids) == 0)
   {
     return;
@@ -58,7 +154,8 @@ extern void reap_background_processes()
   {
     int pid = (int)(long)deq_head_get(background_pids);
     int status;
-    int result = waitpid(pid, &status, WNOHANG);
+    struct rusage ru;
+    int result = wait4(pid, &status, WNOHANG, &ru);
 
     if (result == 0)
     {
@@ -68,14 +165,45 @@ extern void reap_background_processes()
     else if (result == pid)
     {
       // Process terminated, don't put back (it's reaped!)
-      // That's it! Just don't put it back in the queue
+      exitStats(pid);
+      exitResults(pid, status, &ru);
+      exitCoproc(pid);
+      countStats(ST_BGREAPED);
     }
     else if (result == -1)
     {
       // Error or process doesn't exist, don't put back
+      countStats(ST_BGREAPED);
     }
   }
 }
+extern void backgroundCommand(int pid)
+{
+  if (!background_pids)
+    background_pids = deq_new();
+  deq_tail_put(background_pids, (Data)(long)pid);
+  countStats(ST_BGSTART);
+}
+
+extern int foregroundCommand(int pid)
+{
+  // Already reaped
+  if (!background_pids || !deq_len(background_pids) ||
+      deq_head_rem(background_pids, (Data)(long)pid) != (Data)(long)pid)
+    return -1;
+  fgPrio(pid);
+  countStats(ST_BGREAPED);
+  return waitCommand(pid);
+}
+
+extern int runningCommand(int pid)
+{
+  for (int i = 0; background_pids && i < deq_len(background_pids); i++)
+    if ((int)(long)deq_head_ith(background_pids, i) == pid)
+      return 1;
+  return 0;
+}
+
 /**
  * Validates that a builtin command received the correct number of arguments
  *
@@ -94,13 +222,14 @@ extern void reap_background_processes()
  *          Loop: n=1+1=2, *argv++=argv[0] n=1, *argv++=argv[1] n=0, *argv++=NULL loop ends
  *          If n=0 at end, correct number of args!
  */
-static void builtin_args(CommandRep r, int n)
+static int builtin_args(CommandRep r, int n)
 {
   char **argv = r->argv;
   for (n++; *argv++; n--)
     ;
   if (n)
-    ERROR("wrong number of arguments to builtin command"); // warn
+    WARNING("wrong number of arguments to builtin command"); // warn
+  return n;
 }
 
 // BIDEFN(histroy)
@@ -114,23 +243,19 @@ BIDEFN(exit)
   // printf("DEBUG Exit called check for any running processes\n");
   // printf("DEBUG Checking if the background job queue is empry\n");
   // printf("DEBUG length => %d\n", deq_len(background_pids));
-  builtin_args(r, 0);
-  if (background_pids)
-  {
-    while (deq_len(background_pids) > 0)
-    {
-      int exit_pid = (int)(long)deq_head_get(background_pids);
-      waitpid(exit_pid, 0, 0);
-    }
-  }
+  if (builtin_args(r, 0))
+    return 1;
+  endCommand();
 
   *eof = 1; // Set end of file to 1 exiting program
+  return 0;
 }
 
 // Print Working Directory command
 BIDEFN(pwd)
 {
-  builtin_args(r, 0); // valdiate number of arguments
+  if (builtin_args(r, 0)) // valdiate number of arguments
+    return 1;
 
   // Check if current working directory exists
   if (!cwd)
@@ -140,305 +265,1516 @@ BIDEFN(pwd)
   }
   // Out put current directory to terminal
   printf("%s\n", cwd);
+  return 0;
 }
 
 // Change Directory command
 BIDEFN(cd)
 {
-  builtin_args(r, 1); // Validate number of arguments
+  if (builtin_args(r, 1)) // Validate number of arguments
+    return 1;
 
   // Check if the first argument is -
   // - means go to the previous directory
   if (strcmp(r->argv[1], "-") == 0)
   {
+    if (!owd || chdir(owd))
+    {
+      WARNING("chdir() failed");
+      return 1;
+    }
     char *twd = cwd;
     cwd = owd;
     owd = twd;
   }
   else
   {
+    // Change directroy
+    if (chdir(r->argv[1]) == -1)
+    {
+      WARNING("chdir() failed");
+      return 1;
+    }
+
     // IF there was an old working directory
     if (owd)
     {
       free(owd); // free it from memory
     }
     // Update owd and cwd variables
-    owd = cwd;
-
-    // Change directroy
-    if (chdir(r->argv[1]) == -1)
-    {
-      ERROR("chdir() failed");
-      return;
-    }
+    owd = cwd ? cwd : getcwd(0, 0);
 
     // Update cwd variable
     cwd = getcwd(0, 0);
-    if (strcmp(r->argv[1], "-") == 0 && cwd && chdir(cwd))
-      ERROR("chdir() failed");
   }
+  return 0;
 }
-// Implementation of history built in
+// Implementation of history built in: history [N | -s PATTERN]
 BIDEFN(history)
 {
-  // Valdiate number of arguments
-  builtin_args(r, 0);
-  // Get history list
-  HIST_ENTRY **list = history_list();
-  if (!list)
+  // No arguments prints everything, N the last N entries
+  if (!r->argv[1])
+    printHistory(stdout, 0);
+  else if (!strcmp(r->argv[1], "-s"))
   {
-    return;
+    if (builtin_args(r, 2))
+      return 1;
+    searchHistory(stdout, r->argv[2]);
   }
+  else
+  {
+    if (builtin_args(r, 1))
+      return 1;
+    char *end;
+    long n = strtol(r->argv[1], &end, 10);
+    if (*end || end == r->argv[1] || n < 0 || n > INT_MAX)
+    {
+      WARNING("usage: history [N | -s STRING]");
+      return 1;
+    }
+    printHistory(stdout, n);
+  }
+  return 0;
+}
 
-  for (int i = 0; list[i]; i++)
+// Export variables to the environment of commands: export NAME[=value] ...
+BIDEFN(export)
+{
+  for (char **a = r->argv + 1; *a; a++)
   {
-    printf("%d: %s\n", i + history_base, list[i]->line);
+    int n = assignVar(*a);
+    char *name = n ? strndup(*a, n) : strdup(*a);
+    if (n)
+      setVar(name, *a + n + 1);
+    exportVar(name);
+    free(name);
   }
+  return 0;
 }
 
-/**
- * Dispatcher function that checks if a command is a builtin and executes it
- *
- * This function maintains a table of all builtin commands and their
- * corresponding handler functions. It searches the table for a match
- * with the command name and executes it if found.
- *
- * The builtin table is defined using our macros for consistency:
- * - Each entry maps a command name (string) to its function pointer
- * - Table is terminated with {0, 0} sentinel
- *
- * @param r    Command representation (r->file is command name)
- * @param eof  EOF flag pointer (passed to builtin if executed)
- * @param jobs Job table (passed to builtin if executed)
- *
- * @return 1 if command was a builtin and was executed
- *         0 if command was not found in builtin table
- */
-static int builtin(BIARGS)
+// Report the directory listing cache used by glob expansion
+BIDEFN(dircache)
 {
-  typedef struct
-  {
-    char *s;
-    void (*f)(BIARGS);
-  } Builtin;
-  static const Builtin builtins[] = {
-      BIENTRY(exit),
-      BIENTRY(pwd),
-      BIENTRY(cd),
-      BIENTRY(history),
-      {0, 0}};
-  int i;
-  for (i = 0; builtins[i].s; i++)
-    if (!strcmp(r->file, builtins[i].s))
-    {
-      builtins[i].f(r, eof, jobs);
-      return 1;
-    }
+  if (builtin_args(r, 0))
+    return 1;
+  statGlob(stdout);
   return 0;
 }
-/**
- * Converts a T_words linked list from the parse tree into an argv array
- *
- * The parse tree represents command arguments as a linked list of words.
- * The exec family of functions requires arguments as a NULL-terminated
- * array of strings (char**). This function performs that conversion.
- *
- * Algorithm:
- * 1. First pass: Count the number of words in the linked list
- * 2. Allocate array of (n+1) char* pointers (extra slot for NULL terminator)
- * 3. Second pass: Copy each word string into the array
- * 4. Set final element to NULL (required by execvp)
- *
- * Example:
- *   Input:  T_words list: "ls" -> "-l" -> "/tmp" -> NULL
- *   Output: argv array: ["ls", "-l", "/tmp", NULL]
- *
- * @param words  Linked list of words from parse tree
- *
- * @return Newly allocated argv array (caller must free)
- *         NULL-terminated array of string pointers
- */
-static char **getargs(T_words words)
+
+// fg [%N]: wait for background job N (default the latest), at the shell's own priority
+BIDEFN(fg)
 {
-  int n = 0;
-  T_words p = words;
-  while (p)
-  {
-    p = p->words;
+  if (r->argv[1] && builtin_args(r, 1))
+    return 1;
+  char *n = r->argv[1];
+  if (n && *n == '%')
     n++;
+  int status = fgJobs(jobs, n ? atoi(n) : 0);
+  if (status < 0)
+  {
+    WARNING("no such job");
+    return 1;
   }
-  char **argv = (char **)malloc(sizeof(char *) * (n + 1));
-  if (!argv)
-    ERROR("malloc() failed");
-  p = words;
-  int i = 0;
-  while (p)
+  return status;
+}
+
+// bgprio [NICE [idle | be:N | none]]: set or show the priorities background jobs start with
+BIDEFN(bgprio)
+{
+  if (r->argv[1] && r->argv[2] && builtin_args(r, 2))
+    return 1;
+  if (r->argv[1] && setPrio(atoi(r->argv[1]), r->argv[2]))
   {
-    argv[i++] = strdup(p->word->s);
-    p = p->words;
+    WARNING("usage: bgprio [NICE [idle | be:N | none]]");
+    return 1;
   }
-  argv[i] = 0;
-  return argv;
+  printPrio(stdout);
+  return 0;
 }
 
-extern Command newCommand(T_words words, T_redir redir)
+// pin [off | adjacent | spread | cpus=LIST]: place pipeline stages on CPUs, or show the placement
+BIDEFN(pin)
 {
-  CommandRep r = (CommandRep)malloc(sizeof(*r));
-  if (!r)
-    ERROR("malloc() failed");
-  r->argv = getargs(words);
-  r->file = r->argv[0];
-  // handle redirs
-  r->input = redir && redir->input ? strdup(redir->input) : NULL;
-  r->output = redir && redir->output ? strdup(redir->output) : NULL;
-  return r;
+  if (r->argv[1] && builtin_args(r, 1))
+    return 1;
+  if (r->argv[1] && setPin(r->argv[1]))
+  {
+    WARNING("usage: pin [off | adjacent | spread | cpus=LIST]");
+    return 1;
+  }
+  printPin(stdout);
+  return 0;
 }
-/**
- * Child process execution function
- *
- * This function runs in the CHILD process after fork().
- * It's responsible for:
- * 1. Checking if command is a builtin (execute if so, then return)
- * 2. If not builtin, replace child process with the external program (execvp)
- *
- * IMPORTANT: This function only returns if the command is a builtin.
- * If execvp() is called, it REPLACES the child process entirely.
- * If execvp() fails, we error and exit.
- *
- * Why check for builtins in child?
- * - Some builtins might be in a pipeline or backgrounded
- * - In those cases, they should run in a child process, not the shell
- *
- * Process flow:
- *   fork() creates child
- *   ↓
- *   child() called in child process
- *   ↓
- *   Is builtin? → Yes → execute, return, child exits
- *             → No  → execvp replaces process with new program
- *                     (if execvp fails, error and exit)
- *
- * @param r   Command representation to execute
- * @param fg  Foreground flag (currently unused in this function)
- */
-// NEW child() - handles redirection
-static void child(CommandRep r, int fg)
+
+// xargs [-0] [-n N] [-P N] [-k] [command [args...]]: run command on batches of items from stdin
+BIDEFN(xargs)
 {
-  // Handle input redirection
-  if (r->input)
+  return runXargs(r->argv);
+}
+
+// stats: show the shell's counters and latency histograms
+BIDEFN(stats)
+{
+  if (builtin_args(r, 0))
+    return 1;
+  fflush(stdout);
+  printStats(STDOUT_FILENO);
+  return 0;
+}
+
+// allocs [-z WARMUP | -z off]: show allocation counts, or check that repeated lines stop allocating
+BIDEFN(allocs)
+{
+  if (r->argv[1] && (strcmp(r->argv[1], "-z") || !r->argv[2] || r->argv[3]))
   {
-    int fd = open(r->input, O_RDONLY); // Open input file
-    if (fd == -1)
-    {
-      ERROR("failed to open input file");
-      exit(EXIT_FAILURE);
-    }
-    if (dup2(fd, STDIN_FILENO) == -1) // Redirect stdin to file
-    {
-      ERROR("dup2() failed for input");
-      exit(EXIT_FAILURE);
-    }
-    close(fd); // Close original fd, stdin is now the file
+    WARNING("usage: allocs [-z WARMUP | -z off]");
+    return 1;
   }
+  if (r->argv[1])
+    checkAlloc(strcmp(r->argv[2], "off") ? atoi(r->argv[2]) : -1);
+  else
+    printAlloc(stdout);
+  return 0;
+}
 
-  // Handle output redirection
-  if (r->output)
+// compgen -c | -f [PREFIX]: list the commands or files Tab would complete PREFIX to
+BIDEFN(compgen)
+{
+  if (!r->argv[1] || (strcmp(r->argv[1], "-c") && strcmp(r->argv[1], "-f")) ||
+      (r->argv[2] && r->argv[3]))
   {
-    int fd = open(r->output, O_WRONLY | O_CREAT | O_TRUNC, 0666); // Create/open output file
-    if (fd == -1)
-    {
-      ERROR("failed to open output file");
-      exit(EXIT_FAILURE);
-    }
-    if (dup2(fd, STDOUT_FILENO) == -1) // Redirect stdout to file
+    WARNING("usage: compgen -c | -f [PREFIX]");
+    return 1;
+  }
+  return !printComplete(stdout, r->argv[1][1] == 'c', r->argv[2] ? r->argv[2] : "");
+}
+
+// timeout [DURATION | off]: set or show the deadline of foreground pipelines (timeout DURATION pipeline is parsed)
+BIDEFN(timeout)
+{
+  if (r->argv[1] && builtin_args(r, 1))
+    return 1;
+  if (r->argv[1])
+  {
+    long ms = strcmp(r->argv[1], "off") ? parseDeadline(r->argv[1]) : 0;
+    if (ms < 0)
     {
-      ERROR("dup2() failed for output");
-      exit(EXIT_FAILURE);
+      WARNING("usage: timeout [DURATION | off], or timeout DURATION pipeline");
+      return 1;
     }
-    close(fd); // Close original fd, stdout is now the file
+    setDeadline(ms);
   }
+  else
+    printDeadline(stdout);
+  return 0;
+}
 
-  // Now execute - stdin/stdout are redirected if needed
-  int eof = 0;
-  Jobs jobs = newJobs();
-  if (builtin(r, &eof, jobs))
+// capture [launch | completion | off]: set or show how background jobs' output is captured
+BIDEFN(capture)
+{
+  if (r->argv[1] && builtin_args(r, 1))
+    return 1;
+  if (!r->argv[1])
+    printCapture(stdout);
+  else if (setCapture(r->argv[1]))
   {
-    return;
+    WARNING("usage: capture [launch | completion | off]");
+    return 1;
   }
-  execvp(r->argv[0], r->argv);
-  ERROR("execvp() failed");
-  exit(EXIT_FAILURE);
+  return 0;
 }
 
-extern void execCommand(Command command, Pipeline pipeline, Jobs jobs,
-                        int *jobbed, int *eof, int fg)
+// meter [on | off]: set or show whether foreground pipelines are metered
+BIDEFN(meter)
 {
-  // command to execute
-  CommandRep r = command;
-  // printf("DEBUG executing command => %s \n", r->file);
+  if (r->argv[1] && builtin_args(r, 1))
+    return 1;
+  if (!r->argv[1])
+    printMeter(stdout);
+  else if (setMeter(r->argv[1]))
+  {
+    WARNING("usage: meter [on | off]");
+    return 1;
+  }
+  return 0;
+}
 
-  // printf("DEBUG comamand fg is => %d \n", fg);
+// coproc NAME command [args]: start command with its stdin and stdout on pipes to the shell
+BIDEFN(coproc)
+{
+  if (!r->argv[1] || !r->argv[2])
+  {
+    WARNING("usage: coproc NAME command [args]");
+    return 1;
+  }
+  if (newCoproc(r->argv[1], r->argv + 2, jobs))
+  {
+    WARNING("bad coprocess name, or a coprocess has it");
+    return 1;
+  }
+  return 0;
+}
 
-  // IF command is set to run in foreground and is a built in run immediatly
-  if (fg && builtin(r, eof, jobs))
+// jobs [-o %N]: list the background jobs, or show the output captured so far of job N
+BIDEFN(jobs)
+{
+  if (!r->argv[1])
   {
-    // printf("DEBUG this command is a built in!\n");
-    return;
+    listJobs(jobs);
+    return 0;
   }
-  // Check if this command has been jobbed (added to the jobs queue) if not add to jobs queue
-  if (!*jobbed)
+  if (strcmp(r->argv[1], "-o") || !r->argv[2] || r->argv[3])
   {
-    *jobbed = 1;
-    addJobs(jobs, pipeline);
+    WARNING("usage: jobs [-o %N]");
+    return 1;
   }
-  // Fork (create a new child process)
-  int pid = fork();
+  char *n = r->argv[2];
+  if (*n == '%')
+    n++;
+  if (outputJobs(jobs, atoi(n)) < 0)
+  {
+    WARNING("no output captured for that job");
+    return 1;
+  }
+  return 0;
+}
 
-  // printf("DEBUG pid is = %d \n", pid);
+static int enable(char *lib, char *name);
+static int disable(char *name);
+static void listBuiltins();
 
-  if (pid == -1)
+// enable [-f LIB NAME... | -d NAME...]: load builtins from a shared object, unload them, or list all
+BIDEFN(enable)
+{
+  char **a = r->argv + 1;
+  if (!*a)
   {
-    ERROR("fork() failed");
+    listBuiltins();
+    return 0;
   }
-
-  // If process is a child
-  if (pid == 0)
+  int status = 0;
+  if (!strcmp(*a, "-f") && a[1] && a[2])
   {
-    // printf("DEBUG process is a child !!!\n");
-    // process child
-    child(r, fg);
+    for (char **n = a + 2; *n; n++)
+      status |= enable(a[1], *n);
+  }
+  else if (!strcmp(*a, "-d") && a[1])
+  {
+    for (char **n = a + 1; *n; n++)
+      status |= disable(*n);
   }
   else
   {
-    // Process is a parent wait for child to exit
-    if (fg)
-    {
-      int status;
-      waitpid(pid, &status, 0);
-    }
-    else
-    {
-      if (!background_pids)
-      {
-        // printf("DEBUG Init background jobs queue!\n");
-        background_pids = deq_new();
-      }
-      deq_tail_put(background_pids, (Data)(long)pid);
-    }
+    WARNING("usage: enable [-f LIB NAME... | -d NAME...]");
+    return 1;
   }
+  return status;
 }
-extern void freeCommand(Command command)
+
+// echo [-n] words...
+BIDEFN(echo)
 {
-  CommandRep r = command;
-  char **argv = r->argv;
-  while (*argv)
-    free(*argv++);
-  free(r->argv);
-  free(r);
+  char **a = r->argv + 1;
+  int newline = 1;
+  if (*a && !strcmp(*a, "-n"))
+  {
+    newline = 0;
+    a++;
+  }
+  for (; *a; a++)
+  {
+    fputs(*a, stdout);
+    if (a[1])
+      putchar(' ');
+  }
+  if (newline)
+    putchar('\n');
+  return 0;
 }
 
-extern void freestateCommand()
+BIDEFN(true)
+{
+  return 0;
+}
+
+BIDEFN(false)
+{
+  return 1;
+}
+
+// exec [command...]: replace the shell with command, or keep the redirections for the shell
+BIDEFN(exec)
+{
+  if (!r->argv[1])
+    return 0;
+  if (idler)
+  {
+    WARNING("exec can't replace the program running the shell");
+    return 1;
+  }
+  // The cached copy is freed once variables change, the shell goes on with its own
+  char **env = environ;
+  environ = envVars();
+  execvp(r->argv[1], r->argv + 1);
+  environ = env;
+  countStats(ST_EXECFAIL);
+  WARNING("execvp() failed");
+  return 127;
+}
+
+/**
+ * Prints the backslash escape sequence starting at s (after the backslash)
+ *
+ * @return Number of characters of s used
+ */
+static int escape(char *s)
+{
+  static const char from[] = "nt\\abfrv";
+  static const char to[] = "\n\t\\\a\b\f\r\v";
+  char *e = *s ? strchr(from, *s) : 0;
+  if (e)
+  {
+    putchar(to[e - from]);
+    return 1;
+  }
+  putchar('\\');
+  return 0;
+}
+
+// printf format [arguments...], the format is reused while arguments remain
+BIDEFN(printf)
 {
+  if (!r->argv[1])
+  {
+    WARNING("usage: printf format [arguments]");
+    return 1;
+  }
+  char *fmt = r->argv[1];
+  char **a = r->argv + 2;
+  char **start;
+  do
+  {
+    start = a;
+    for (char *p = fmt; *p; p++)
+    {
+      if (*p == '\\')
+      {
+        p += escape(p + 1);
+        continue;
+      }
+      if (*p != '%')
+      {
+        putchar(*p);
+        continue;
+      }
+      if (p[1] == '%')
+      {
+        putchar('%');
+        p++;
+        continue;
+      }
+      // Copy flags, width and precision, then convert the next argument
+      char spec[32];
+      int n = 0;
+      spec[n++] = '%';
+      for (p++; *p && strchr("-+ #0123456789.", *p) && n < 28; p++)
+        spec[n++] = *p;
+      if (!*p)
+        break;
+      char *arg = *a ? *a++ : "";
+      switch (*p)
+      {
+      case 'd':
+      case 'i':
+        spec[n++] = 'l';
+        spec[n++] = *p;
+        spec[n] = 0;
+        printf(spec, strtol(arg, 0, 0));
+        break;
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'o':
+        spec[n++] = 'l';
+        spec[n++] = *p;
+        spec[n] = 0;
+        printf(spec, strtoul(arg, 0, 0));
+        break;
+      case 'c':
+        spec[n++] = 'c';
+        spec[n] = 0;
+        printf(spec, *arg);
+        break;
+      case 'b':
+        for (; *arg; arg++)
+          if (*arg == '\\')
+            arg += escape(arg + 1);
+          else
+            putchar(*arg);
+        break;
+      default:
+        spec[n++] = 's';
+        spec[n] = 0;
+        printf(spec, arg);
+      }
+    }
+  } while (*a && a != start);
+  return 0;
+}
+
+/**
+ * The table of builtin commands
+ *
+ * The builtin table is defined using our macros for consistency:
+ * - Each entry maps a command name (string) to its function pointer
+ * - Table is terminated with {0, 0} sentinel
+ *
+ * Builtins loaded by enable -f get an entry of their own, with ext (and
+ * dl, the library it came from) set instead of f.
+ */
+typedef struct
+{
+  char *s;
+  int (*f)(BIARGS);
+  const ShellBuiltin *ext;
+  void *dl;
+} Builtin;
+static const Builtin builtins[] = {
+    BIENTRY(exit),
+    BIENTRY(pwd),
+    BIENTRY(cd),
+    BIENTRY(history),
+    BIENTRY(export),
+    BIENTRY(dircache),
+    BIENTRY(echo),
+    BIENTRY(printf),
+    BIENTRY(true),
+    BIENTRY(false),
+    BIENTRY(exec),
+    BIENTRY(pin),
+    BIENTRY(fg),
+    BIENTRY(bgprio),
+    BIENTRY(enable),
+    BIENTRY(xargs),
+    BIENTRY(stats),
+    BIENTRY(allocs),
+    BIENTRY(compgen),
+    BIENTRY(timeout),
+    BIENTRY(capture),
+    BIENTRY(jobs),
+    BIENTRY(meter),
+    BIENTRY(coproc),
+    {":", BINAME(true)},
+    {0, 0}};
+
+// Every command is looked up, so builtins are found by hash rather than a scan
+#define BUCKETS 64
+
+typedef struct Slot
+{
+  const Builtin *b;
+  struct Slot *next;
+} *Slot;
+
+static Slot table[BUCKETS];
+static Deq loaded = 0; // Builtins from enable -f, in the order loaded
+
+// FNV-1a
+static unsigned hash(const char *s)
+{
+  unsigned h = 2166136261u;
+  for (; *s; s++)
+    h = (h ^ (unsigned char)*s) * 16777619u;
+  return h;
+}
+
+/**
+ * Adds a builtin to the hash table, ahead of (shadowing) any of the same name
+ */
+static void insert(const Builtin *b)
+{
+  Slot s = malloc(sizeof(*s));
+  if (!s)
+    ERROR("malloc() failed");
+  unsigned h = hash(b->s) & (BUCKETS - 1);
+  s->b = b;
+  s->next = table[h];
+  table[h] = s;
+}
+
+/**
+ * Fills the hash table with the compiled-in builtins on first use
+ */
+static void init()
+{
+  if (loaded)
+    return;
+  loaded = deq_new();
+  for (int i = 0; builtins[i].s; i++)
+    insert(&builtins[i]);
+}
+
+/**
+ * Finds a builtin by command name
+ *
+ * @return Table entry, or NULL if name is not a builtin
+ */
+static const Builtin *lookup(char *name)
+{
+  init();
+  for (Slot s = table[hash(name) & (BUCKETS - 1)]; s; s = s->next)
+    if (!strcmp(name, s->b->s))
+      return s->b;
+  return 0;
+}
+
+/**
+ * Loads the builtin shell_builtin_NAME from a shared object
+ *
+ * @return 0 on success, 1 (already reported) on failure
+ */
+static int enable(char *lib, char *name)
+{
+  init();
+  void *dl = dlopen(lib, RTLD_NOW | RTLD_LOCAL);
+  if (!dl)
+  {
+    WARNING(dlerror());
+    return 1;
+  }
+  char sym[256];
+  snprintf(sym, sizeof(sym), "shell_builtin_%s", name);
+  const ShellBuiltin *ext = dlsym(dl, sym);
+  if (!ext || ext->abi != BUILTIN_ABI || !ext->run || strcmp(ext->name, name))
+  {
+    WARNING(ext ? "builtin was built for another ABI version" : "no such builtin in library");
+    dlclose(dl);
+    return 1;
+  }
+  Builtin *b = malloc(sizeof(*b));
+  if (!b)
+    ERROR("malloc() failed");
+  b->s = strdup(name);
+  b->f = 0;
+  b->ext = ext;
+  b->dl = dl;
+  insert(b);
+  deq_tail_put(loaded, b);
+  return 0;
+}
+
+static void freeBuiltin(Data d)
+{
+  Builtin *b = d;
+  dlclose(b->dl);
+  free(b->s);
+  free(b);
+}
+
+/**
+ * Unloads a builtin loaded by enable(), uncovering any it shadowed
+ *
+ * @return 0 on success, 1 (already reported) if name wasn't loaded
+ */
+static int disable(char *name)
+{
+  const Builtin *b = lookup(name);
+  if (!b || !b->ext)
+  {
+    WARNING("not a loaded builtin");
+    return 1;
+  }
+  for (Slot *p = &table[hash(name) & (BUCKETS - 1)]; *p; p = &(*p)->next)
+    if ((*p)->b == b)
+    {
+      Slot s = *p;
+      *p = s->next;
+      free(s);
+      break;
+    }
+  deq_head_rem(loaded, (Data)b);
+  freeBuiltin((Data)b);
+  return 0;
+}
+
+/**
+ * Prints the name of every builtin, loaded ones with their usage
+ */
+static void listBuiltins()
+{
+  init();
+  for (int i = 0; builtins[i].s; i++)
+    printf("%s\n", builtins[i].s);
+  for (int i = 0; i < deq_len(loaded); i++)
+  {
+    Builtin *b = deq_head_ith(loaded, i);
+    printf("%s (%s)\n", b->s, b->ext->usage);
+  }
+}
+
+/**
+ * Dispatcher function that checks if a command is a builtin and executes it
+ *
+ * It searches the builtin table for a match with the command name and
+ * executes it if found.
+ *
+ * @param r    Command representation (r->file is command name)
+ * @param eof  EOF flag pointer (passed to builtin if executed)
+ * @param jobs Job table (passed to builtin if executed)
+ *
+ * @return The builtin's exit status if command was a builtin and was executed
+ *         -1 if command was not found in builtin table
+ */
+static int builtin(BIARGS)
+{
+  const Builtin *b = lookup(r->file);
+  if (!b)
+    return -1;
+  if (!b->ext)
+    return b->f(r, eof, jobs);
+  // A loaded builtin writes to the fds directly, after anything we buffered
+  fflush(stdout);
+  int argc = 0;
+  while (r->argv[argc])
+    argc++;
+  return b->ext->run(argc, r->argv, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO);
+}
+/**
+ * Converts a T_words linked list from the parse tree into an array of words
+ *
+ * The parse tree represents command arguments as a linked list of words.
+ * The exec family of functions requires arguments as a NULL-terminated
+ * array of strings (char**). This function performs that conversion;
+ * getargs() then expands the words into argv.
+ *
+ * The word strings are moved out of the tree rather than copied: a tree
+ * is walked once to build its commands and then freed, and the command
+ * outlives it (in a background job). The array is a recycled block (see
+ * Alloc.h), as are the strings, so freewords() gives both back.
+ *
+ * Example:
+ *   Input:  T_words list: "ls" -> "-l" -> "/tmp" -> NULL
+ *   Output: words array: ["ls", "-l", "/tmp", NULL]
+ *
+ * @param words  Linked list of words from parse tree
+ *
+ * @return Newly allocated words array (caller must freewords())
+ *         NULL-terminated array of string pointers
+ */
+static char **getwords(T_words words)
+{
+  int n = 0;
+  T_words p = words;
+  while (p)
+  {
+    p = p->words;
+    n++;
+  }
+  char **argv = (char **)newAlloc(AL_COMMAND, sizeof(char *) * (n + 1));
+  if (!argv)
+    ERROR("malloc() failed");
+  p = words;
+  int i = 0;
+  while (p)
+  {
+    argv[i++] = p->word->s;
+    p->word->s = 0;
+    p = p->words;
+  }
+  argv[i] = 0;
+  return argv;
+}
+
+/**
+ * Frees a words array from getwords()
+ */
+static void freewords(char **words)
+{
+  if (!words)
+    return;
+  char **w = words;
+  for (; *w; w++)
+    freedupAlloc(*w);
+  freeAlloc(words, sizeof(char *) * (w - words + 1));
+}
+
+/**
+ * Frees an argv from getargs(): a recycled array of strings from expansion
+ */
+static void freeargs(char **argv)
+{
+  if (!argv)
+    return;
+  char **a = argv;
+  for (; *a; a++)
+    free(*a);
+  freeAlloc(argv, sizeof(char *) * (a - argv + 1));
+}
+
+// The process substitution that is word i, if it is one
+static Subst subst(CommandRep r, int i)
+{
+  for (int j = 0; r->substs && j < deq_len(r->substs); j++)
+  {
+    Subst s = deq_head_ith(r->substs, j);
+    if (s->word == i)
+      return s;
+  }
+  return 0;
+}
+
+/**
+ * Builds argv from the command's words, expanding variables and globs
+ *
+ * Runs every time the command is executed, so a variable set earlier on
+ * the same line (X=1 ; echo $X) is seen. Leading NAME=value words are
+ * assignments and are left out of argv; a word that expands to nothing
+ * is dropped, as there is no quoting to keep it. Each remaining word
+ * then goes through brace and pathname expansion (*.log, {a,b}), which
+ * may turn it into several arguments.
+ *
+ * @param r  Command whose argv and file are (re)built
+ */
+static void getargs(CommandRep r)
+{
+  freeargs(r->argv);
+  char **w = r->words;
+  while (*w && assignVar(*w))
+    w++;
+  Deq args = deq_new();
+  for (; *w; w++)
+  {
+    Subst s = subst(r, w - r->words);
+    if (s)
+    {
+      // Becomes /dev/fd/N once started, by substitute()
+      s->arg = deq_len(args);
+      char *a = strdup(*w);
+      if (!a)
+        ERROR("strdup() failed");
+      deq_tail_put(args, a);
+      continue;
+    }
+    char *a = expandVars(*w);
+    if (*a || !strchr(*w, '$'))
+      expandGlob(a, args);
+    free(a);
+  }
+  int n = deq_len(args);
+  r->argv = (char **)newAlloc(AL_COMMAND, sizeof(char *) * (n + 1));
+  if (!r->argv)
+    ERROR("malloc() failed");
+  for (int i = 0; i < n; i++)
+    r->argv[i] = deq_head_get(args);
+  r->argv[n] = 0;
+  deq_del(args, 0);
+  r->file = r->argv[0];
+}
+
+/**
+ * Performs the command's leading NAME=value assignments
+ *
+ * @param r       Command whose words start with the assignments
+ * @param export  Non-zero to also export them (NAME=v cmd prefixes, in the child)
+ */
+static void assign(CommandRep r, int export)
+{
+  for (char **w = r->words; *w; w++)
+  {
+    int n = assignVar(*w);
+    if (!n)
+      break;
+    // The name is cut off in place for the moment, rather than copied
+    char *value = expandVars(*w + n + 1);
+    (*w)[n] = 0;
+    setVar(*w, value);
+    if (export)
+      exportVar(*w);
+    (*w)[n] = '=';
+    free(value);
+  }
+}
+
+extern Command newCommand(T_words words, T_redir redir)
+{
+  CommandRep r = (CommandRep)newAlloc(AL_COMMAND, sizeof(*r));
+  if (!r)
+    ERROR("malloc() failed");
+  r->words = getwords(words);
+  r->argv = 0;
+  r->file = 0;
+  // handle redirs
+  r->input = redir && redir->input ? strdup(redir->input) : NULL;
+  r->output = redir && redir->output ? strdup(redir->output) : NULL;
+  r->here = redir && redir->here ? strdup(redir->here) : NULL;
+  r->dupin = redir && redir->dupin;
+  r->dupout = redir && redir->dupout;
+  r->group = 0;
+  r->subshell = 0;
+  r->control = 0;
+  r->substs = 0;
+  return r;
+}
+
+extern void substCommand(Command command, int word, Sequence sequence)
+{
+  CommandRep r = command;
+  Subst s = malloc(sizeof(*s));
+  if (!s)
+    ERROR("malloc() failed");
+  s->word = word;
+  s->out = r->words[word][0] == '>';
+  s->sequence = sequence;
+  s->arg = -1;
+  s->fd = -1;
+  if (!r->substs)
+    r->substs = deq_new();
+  deq_tail_put(r->substs, s);
+}
+
+/**
+ * Starts the command's process substitutions, each on a pipe of its own
+ *
+ * Each <( ) or >( ) argument becomes /dev/fd/N, N being the command's
+ * end of the pipe. That end is close-on-exec: keep() lets the program
+ * have it, and every other child goes without it, the substitutions
+ * started after it included. They are started in the shell for a
+ * command on its own, in its child for a pipeline stage, and again
+ * each time the command runs. The shell doesn't wait for them.
+ *
+ * @param r  Command whose argv has been built by getargs()
+ */
+static void substitute(CommandRep r)
+{
+  for (int i = 0; r->substs && i < deq_len(r->substs); i++)
+  {
+    Subst s = deq_head_ith(r->substs, i);
+    if (s->fd != -1 || s->arg == -1)
+      continue;
+    int fd[2];
+    if (pipe2(fd, O_CLOEXEC) == -1)
+      ERROR("pipe2() failed");
+    countStats(ST_PIPES);
+    fflush(stdout);
+    int pid = fork();
+    if (pid == -1)
+      ERROR("fork() failed");
+    if (!pid)
+    {
+      for (int j = 0; j < i; j++)
+        close(((Subst)deq_head_ith(r->substs, j))->fd);
+      if (dup2(fd[s->out ? 0 : 1], s->out ? STDIN_FILENO : STDOUT_FILENO) == -1)
+        ERROR("dup2() failed");
+      close(fd[0]);
+      close(fd[1]);
+      int eof = 0;
+      int status = execSequence(s->sequence, newJobs(), &eof);
+      s->sequence = 0;
+      quit(status);
+    }
+    forkStats(pid);
+    backgroundCommand(pid);
+    close(fd[s->out ? 0 : 1]);
+    s->fd = fd[s->out ? 1 : 0];
+    free(r->argv[s->arg]);
+    if (asprintf(&r->argv[s->arg], "/dev/fd/%d", s->fd) == -1)
+      ERROR("asprintf() failed");
+    r->file = r->argv[0];
+  }
+}
+
+// Lets the program about to be exec'd have its substitutions' ends
+static void keep(CommandRep r)
+{
+  for (int i = 0; r->substs && i < deq_len(r->substs); i++)
+  {
+    Subst s = deq_head_ith(r->substs, i);
+    if (s->fd != -1)
+      fcntl(s->fd, F_SETFD, 0);
+  }
+}
+
+// Closes the shell's ends of the substitutions once the command has them
+static void unsubst(CommandRep r)
+{
+  for (int i = 0; r->substs && i < deq_len(r->substs); i++)
+  {
+    Subst s = deq_head_ith(r->substs, i);
+    if (s->fd != -1)
+      close(s->fd);
+    s->fd = -1;
+  }
+}
+
+static void freeSubst(Data d)
+{
+  Subst s = d;
+  if (s->sequence)
+    freeSequence(s->sequence);
+  free(s);
+}
+
+extern Command newGroup(Sequence sequence, T_redir redir, int subshell)
+{
+  CommandRep r = newCommand(0, redir);
+  r->group = sequence;
+  r->subshell = subshell;
+  return r;
+}
+
+extern Command newCompound(Control control, T_redir redir)
+{
+  CommandRep r = newCommand(0, redir);
+  r->control = control;
+  return r;
+}
+/**
+ * Creates a file descriptor that reads back a here-document body
+ *
+ * The body never touches the disk. A body that fits in a pipe without
+ * blocking (PIPE_BUF) is written into a pipe, anything larger goes into
+ * an anonymous memory file (memfd_create) that is rewound to the start.
+ *
+ * @param s  Here-document body
+ *
+ * @return Readable file descriptor (close-on-exec), -1 on failure
+ */
+static int herefd(char *s)
+{
+  size_t n = strlen(s);
+  int fd[2];
+  if (n <= PIPE_BUF)
+  {
+    if (pipe2(fd, O_CLOEXEC) == -1)
+      return -1;
+    countStats(ST_PIPES);
+    if (write(fd[1], s, n) != (ssize_t)n)
+    {
+      close(fd[0]);
+      close(fd[1]);
+      return -1;
+    }
+    close(fd[1]);
+    return fd[0];
+  }
+  int m = memfd_create("here", MFD_CLOEXEC);
+  if (m == -1)
+    return -1;
+  for (size_t done = 0; done < n;)
+  {
+    ssize_t w = write(m, s + done, n - done);
+    if (w == -1)
+    {
+      close(m);
+      return -1;
+    }
+    done += w;
+  }
+  lseek(m, 0, SEEK_SET);
+  return m;
+}
+
+/**
+ * Puts a file descriptor on stdin or stdout
+ *
+ * @return 0 on success, -1 (with fd closed) on failure
+ */
+static int redirfd(int fd, int to, char *what)
+{
+  if (fd == -1)
+  {
+    WARNING(what);
+    return -1;
+  }
+  int ok = dup2(fd, to);
+  close(fd); // Close original fd, stdin/stdout is now the file
+  if (ok == -1)
+  {
+    WARNING("dup2() failed");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Puts a copy of descriptor s (<&N, >&N) on stdin or stdout
+ *
+ * s is expanded first (${CALC[1]}). Unlike a file's, the descriptor
+ * stays open: it belongs to the shell (a coprocess's pipe).
+ *
+ * @return 0 on success, -1 on failure (reported)
+ */
+static int redirdup(char *s, int to)
+{
+  char *n = expandVars(s), *end;
+  long fd = strtol(n, &end, 10);
+  int bad = !*n || *end || fd < 0 || fd > INT_MAX;
+  free(n);
+  if (bad || dup2(fd, to) == -1)
+  {
+    WARNING("bad file descriptor to redirect");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Applies a command's redirections to the current process
+ *
+ * Input comes from the < file or the here-document, output goes to the
+ * > file. Both override whatever stdin/stdout were before (e.g. pipes).
+ * File names are expanded first ($OUT). <&N and >&N take a descriptor
+ * in place of a file.
+ *
+ * @param r  Command whose redirections are applied
+ *
+ * @return 0 on success, -1 if a redirection failed (already reported)
+ */
+static int redir(CommandRep r)
+{
+  // Handle input redirection
+  if (r->input && r->dupin)
+  {
+    if (redirdup(r->input, STDIN_FILENO))
+      return -1;
+  }
+  else if (r->input)
+  {
+    char *f = expandVars(r->input);
+    int fd = open(f, O_RDONLY | O_CLOEXEC); // Open input file
+    free(f);
+    if (redirfd(fd, STDIN_FILENO, "failed to open input file"))
+      return -1;
+  }
+
+  // Handle here-document/here-string
+  if (r->here && redirfd(herefd(r->here), STDIN_FILENO, "failed to create here-document"))
+    return -1;
+
+  // Handle output redirection
+  if (r->output && r->dupout)
+  {
+    if (redirdup(r->output, STDOUT_FILENO))
+      return -1;
+  }
+  else if (r->output)
+  {
+    char *f = expandVars(r->output);
+    int fd = open(f, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666); // Create/open output file
+    free(f);
+    if (redirfd(fd, STDOUT_FILENO, "failed to open output file"))
+      return -1;
+  }
+  return 0;
+}
+
+/**
+ * Saves the shell's own stdin/stdout before redirecting them in-process
+ *
+ * The copies go above fd 10, close-on-exec, out of the way of the
+ * redirections and out of children.
+ */
+static void savefds(int save[2])
+{
+  held++;
+  fflush(stdout);
+  save[0] = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+  save[1] = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+}
+
+/**
+ * Puts back stdin/stdout saved by savefds()
+ */
+static void restorefds(int save[2])
+{
+  fflush(stdout);
+  for (int fd = 0; fd < 2; fd++)
+  {
+    if (save[fd] == -1)
+      close(fd);
+    else
+    {
+      dup2(save[fd], fd);
+      close(save[fd]);
+    }
+  }
+  held--;
+}
+
+/**
+ * Runs a builtin in the shell process, with its redirections
+ *
+ * stdin/stdout are saved, redirected for the builtin and put back
+ * afterwards, so "pwd > f" needs no fork.
+ *
+ * @return The builtin's exit status, or -1 if the command is not a builtin
+ */
+static int inprocess(BIARGS)
+{
+  const Builtin *b = lookup(r->file);
+  if (!b)
+    return -1;
+  countStats(ST_BUILTINS);
+  stageResults(r->argv, 0);
+  // Plain "exec > f" redirects the shell itself, for good: nothing is put back
+  if (b->f == BINAME(exec) && !r->argv[1])
+  {
+    // stdin/stdout are the host program's, not the session's
+    if (idler)
+    {
+      WARNING("exec can't redirect the program running the shell");
+      return 1;
+    }
+    fflush(stdout);
+    return redir(r) ? 1 : 0;
+  }
+  if (!r->input && !r->output && !r->here)
+  {
+    int status = builtin(r, eof, jobs);
+    fflush(stdout); // keep order with the output of children
+    return status;
+  }
+
+  int save[2];
+  savefds(save);
+  int status = redir(r) ? 1 : builtin(r, eof, jobs);
+  restorefds(save);
+  return status;
+}
+
+/**
+ * Runs a { } group, or an if, while or for, in the shell process
+ *
+ * The redirections are applied once, around the whole group, so every
+ * command in it shares one open of the output file, and builtins in the
+ * group (cd, export, ...) affect the shell. The group is kept, to run
+ * again if it is in a loop.
+ *
+ * @return Exit status of the group's last pipeline
+ */
+static int ingroup(BIARGS)
+{
+  int save[2];
+  savefds(save);
+  int status = 1;
+  if (!redir(r))
+    status = r->control ? execControl(r->control, jobs, eof) : runSequence(r->group, jobs, eof);
+  restorefds(save);
+  return status;
+}
+
+extern int waitCommand(int pid)
+{
+  int status;
+  struct rusage ru;
+  idleCommand(1);
+  int r = wait4(pid, &status, 0, &ru);
+  idleCommand(0);
+  if (r == -1)
+    return 1;
+  exitStats(pid);
+  exitResults(pid, status, &ru);
+  exitCoproc(pid);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+
+/**
+ * Child process execution function
+ *
+ * This function runs in the CHILD process after fork(), after any pipe
+ * ends have been put on stdin/stdout. It's responsible for:
+ * 1. Applying the command's redirections (<, <<, <<<, >), which override pipes
+ * 2. Checking if command is a builtin (execute if so, then exit)
+ * 3. If not builtin, replace child process with the external program (execvp)
+ *
+ * IMPORTANT: This function never returns.
+ * If execvp() is called, it REPLACES the child process entirely.
+ * If execvp() fails, we error and exit.
+ *
+ * Why check for builtins in child?
+ * - Some builtins might be in a pipeline or backgrounded
+ * - In those cases, they should run in a child process, not the shell
+ *
+ * @param command  Command to execute
+ */
+extern void childCommand(Command command)
+{
+  CommandRep r = command;
+  // Pipeline stages come expanded by the shell (argsCommand()), anything else is expanded here
+  if (!r->group && !r->control && !r->argv)
+    getargs(r);
+
+  if (redir(r))
+    quit(EXIT_FAILURE);
+
+  int eof = 0;
+  Jobs jobs = newJobs();
+  // A group (subshell, or { } that had to fork) runs its pipelines in this process
+  if (r->group || r->control)
+  {
+    int status = r->control ? execControl(r->control, jobs, &eof) : execSequence(r->group, jobs, &eof);
+    r->group = 0;
+    quit(status);
+  }
+
+  // Only assignments: they would vanish with this child anyway
+  if (!r->file)
+    quit(EXIT_SUCCESS);
+
+  // A pipeline stage starts its own <( ) and >( ), a command on its own has them from the shell
+  substitute(r);
+
+  // NAME=value prefixes go into this command's environment only
+  assign(r, 1);
+
+  // Now execute - stdin/stdout are redirected if needed
+  int status = builtin(r, &eof, jobs);
+  if (status >= 0)
+    quit(status);
+  environ = envVars();
+  keep(r);
+  execvp(r->argv[0], r->argv);
+  countStats(ST_EXECFAIL);
+  WARNING("execvp() failed");
+  quit(EXIT_FAILURE);
+}
+
+extern int execCommand(Command command, Pipeline pipeline, Jobs jobs,
+                       int *jobbed, int *eof, int fg, int last)
+{
+  // command to execute
+  CommandRep r = command;
+  // printf("DEBUG executing command => %s \n", r->file);
+
+  // printf("DEBUG comamand fg is => %d \n", fg);
+
+  if (r->group || r->control)
+  {
+    // A { } group (or if, while, for) in the foreground needs no fork at all, a ( ) subshell exactly one
+    if (fg && !r->subshell)
+    {
+      stageResults(0, 0);
+      return ingroup(r, eof, jobs);
+    }
+  }
+  else
+  {
+    // Expand the words now, variables may have changed since the line was parsed
+    getargs(r);
+
+    // Only assignments (X=1): set them in the shell
+    if (!r->file)
+    {
+      stageResults(0, 0);
+      if (fg)
+        assign(r, 0);
+      return 0;
+    }
+
+    substitute(r);
+    // IF command is set to run in foreground and is a built in run immediatly, no fork even with redirections
+    int status = fg ? inprocess(r, eof, jobs) : -1;
+    if (status >= 0)
+    {
+      unsubst(r);
+      // printf("DEBUG this command is a built in!\n");
+      return status;
+    }
+  }
+  // A background command is kept as a job (for fg) if not already; a foreground one
+  // is done with once it has been waited for, and is freed rather than piling up
+  if (!fg && !*jobbed)
+  {
+    *jobbed = 1;
+    addJobs(jobs, pipeline);
+  }
+  // Nothing runs afterwards: become the command instead of forking and waiting,
+  // unless there is a deadline to enforce, or output to capture or report after it
+  long ms = deadlinePipeline(pipeline);
+  if (fg && last && !ms && !onResults() && !onCapture())
+    childCommand(r);
+
+  // Build the exec environment in the shell, so every child shares the cached copy
+  envVars();
+  // A child that runs a builtin exits through stdio, don't let it repeat our output
+  fflush(stdout);
+  // Fork (create a new child process)
+  int pid = fork();
+
+  // printf("DEBUG pid is = %d \n", pid);
+
+  if (pid == -1)
+  {
+    ERROR("fork() failed");
+  }
+  if (pid)
+  {
+    forkStats(pid);
+    stageResults(r->argv, pid);
+    unsubst(r);
+  }
+
+  // If process is a child
+  if (pid == 0)
+  {
+    // printf("DEBUG process is a child !!!\n");
+    // process child
+    if (ms)
+      joinDeadline(0, 0);
+    if (!fg)
+    {
+      childCapture(capturePipeline(pipeline), 1);
+      bgPrio();
+    }
+    childCommand(r);
+  }
+  else
+  {
+    // Process is a parent wait for child to exit
+    if (ms)
+    {
+      joinDeadline(pid, 0);
+      return waitDeadline(&pid, 1, 0, ms);
+    }
+    if (fg)
+      return waitCommand(pid);
+    pidPipeline(pipeline, pid);
+  }
+  return 0;
+}
+extern int redirCommand(Command command, int in, int out)
+{
+  CommandRep r = command;
+  if (!in)
+  {
+    free(r->input);
+    free(r->here);
+    r->input = r->here = 0;
+    r->dupin = 0;
+  }
+  if (!out)
+  {
+    free(r->output);
+    r->output = 0;
+    r->dupout = 0;
+  }
+  int status = redir(r);
+  free(r->input);
+  free(r->here);
+  free(r->output);
+  r->input = r->here = r->output = 0;
+  r->dupin = r->dupout = 0;
+  return status;
+}
+
+extern char **argsCommand(Command command)
+{
+  CommandRep r = command;
+  // Every run, as variables may have changed since the last (in a loop)
+  if (!r->group && !r->control)
+    getargs(r);
+  return r->argv;
+}
+
+extern void freeCommand(Command command)
+{
+  CommandRep r = command;
+  freewords(r->words);
+  freeargs(r->argv);
+  if (r->input)
+    free(r->input);
+  if (r->output)
+    free(r->output);
+  if (r->here)
+    free(r->here);
+  if (r->group)
+    freeSequence(r->group);
+  if (r->control)
+    freeControl(r->control);
+  if (r->substs)
+    deq_del(r->substs, freeSubst);
+  freeAlloc(r, sizeof(*r));
+}
+
+// What swapCommand() saves of the state above
+typedef struct
+{
+  char *owd;
+  char *cwd;
+  Deq background_pids;
+} *CommandState;
+
+extern void *swapCommand(void *state)
+{
+  CommandState old = malloc(sizeof(*old));
+  if (!old)
+    ERROR("malloc() failed");
+  old->owd = owd;
+  old->cwd = cwd;
+  old->background_pids = background_pids;
+  CommandState s = state;
+  owd = s ? s->owd : 0;
+  cwd = s ? s->cwd : 0;
+  background_pids = s ? s->background_pids : 0;
+  free(s);
+  return old;
+}
+
+extern void endCommand()
+{
+  // Coprocesses wait for input until the shell closes its end
+  closeCoproc();
+  while (background_pids && deq_len(background_pids) > 0)
+  {
+    int pid = (int)(long)deq_head_get(background_pids);
+    int status;
+    struct rusage ru;
+    idleCommand(1);
+    int r = wait4(pid, &status, 0, &ru);
+    idleCommand(0);
+    if (r == pid)
+    {
+      exitResults(pid, status, &ru);
+      exitCoproc(pid);
+    }
+    countStats(ST_BGREAPED);
+  }
+}
+
+extern void dropCommand(void *state)
+{
+  CommandState s = state;
+  if (s->background_pids)
+  {
+    // Like exit, wait for whatever is still running
+    while (deq_len(s->background_pids))
+    {
+      waitpid((int)(long)deq_head_get(s->background_pids), 0, 0);
+      countStats(ST_BGREAPED);
+    }
+    deq_del(s->background_pids, 0);
+  }
+  free(s->owd);
+  free(s->cwd);
+  free(s);
+}
+
+extern void freestateCommand()
+{
+  for (int i = 0; i < BUCKETS; i++)
+  {
+    for (Slot s = table[i], next; s; s = next)
+    {
+      next = s->next;
+      free(s);
+    }
+    table[i] = 0;
+  }
+  if (loaded)
+    deq_del(loaded, freeBuiltin);
+  loaded = 0;
   if (cwd)
     free(cwd);
   if (owd)
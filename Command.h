@@ -6,6 +6,7 @@ typedef void *Command;
 #include "Tree.h"
 #include "Jobs.h"
 #include "Sequence.h"
+#include "Control.h"
 /**
  * Reap terminated background processes to prevent zombies
  * Should be called periodically (e.g., after each command)
@@ -35,6 +36,47 @@ extern void reap_background_processes();
  *   Output: Command with argv=["cat", "file.txt", NULL], file="cat"
  */
 extern Command newCommand(T_words words, T_redir redir);
+/**
+ * Creates a Command that runs a group of pipelines
+ *
+ * A { } group runs in the shell process when it is a foreground command
+ * on its own, with its redirections applied once around the whole group.
+ * A ( ) subshell always runs in a single forked process.
+ *
+ * @param sequence  Pipelines of the group, owned by the command
+ * @param redir     Redirections for the whole group
+ * @param subshell  Non-zero for ( ), zero for { }
+ *
+ * @return Command object
+ */
+extern Command newGroup(Sequence sequence, T_redir redir, int subshell);
+
+/**
+ * Creates a compound command: an if, while or for (see Control.h)
+ *
+ * Like a { } group it runs in the shell in the foreground, and in a
+ * child of its own in the background or a pipeline.
+ *
+ * @param control  The if, while or for
+ * @param redir    Redirections around all of it
+ *
+ * @return New Command
+ */
+extern Command newCompound(Control control, T_redir redir);
+
+/**
+ * Makes one of a command's words a process substitution
+ *
+ * Each time the command runs, the sequence is started on a pipe and the
+ * word, "<(" or ">(", becomes /dev/fd/N: the command reads what a <( )
+ * writes, and a >( ) reads what the command writes there. Only the
+ * program the command runs gets N; it is closed in every other child.
+ *
+ * @param command   Command from newCommand()
+ * @param word      Index of the word among the command's words
+ * @param sequence  Pipelines to run, owned by the command
+ */
+extern void substCommand(Command command, int word, Sequence sequence);
 /**
  * Executes a command - the main entry point for command execution
  *
@@ -59,9 +101,91 @@ extern Command newCommand(T_words words, T_redir redir);
  *                 (Set to 1 after first command adds it)
  * @param eof      EOF flag pointer (set by exit builtin)
  * @param fg       Foreground flag: 1=foreground (wait), 0=background (don't wait)
+ * @param last     Nothing runs after this command (end of a script or -c):
+ *                 a foreground program is exec'd in place of the shell
+ *
+ * @return Exit status of the command (128+signal if killed), 0 if in the background
  */
-extern void execCommand(Command command, Pipeline pipeline, Jobs jobs,
-						int *jobbed, int *eof, int fg);
+extern int execCommand(Command command, Pipeline pipeline, Jobs jobs,
+					   int *jobbed, int *eof, int fg, int last);
+
+/**
+ * Waits for a child process
+ *
+ * Other sessions may run meanwhile, see idleCommand().
+ *
+ * @param pid  Child to wait for
+ *
+ * @return Its exit status, or 128+signal if it was killed
+ */
+extern int waitCommand(int pid);
+
+/**
+ * Records a background process, to be reaped once it exits
+ *
+ * @param pid  Process started in the background
+ */
+extern void backgroundCommand(int pid);
+
+/**
+ * Brings a background process to the foreground: gives it the shell's
+ * priority back and waits for it
+ *
+ * @param pid  Process recorded by backgroundCommand()
+ *
+ * @return Its exit status, or -1 if it has already been reaped
+ */
+extern int foregroundCommand(int pid);
+
+/**
+ * Whether a background process is still to be reaped
+ *
+ * @param pid  Process recorded by backgroundCommand()
+ *
+ * @return Non-zero if it hasn't been reaped (or brought to the foreground)
+ */
+extern int runningCommand(int pid);
+
+/**
+ * Runs a command in an already forked child process; never returns
+ *
+ * Applies the command's own redirections (<, <<, <<<, >) on top of
+ * whatever stdin/stdout the caller set up (e.g. pipe ends), then runs
+ * the builtin or execvp()s the program. The child exits when done.
+ *
+ * @param command  Command to run
+ */
+extern void childCommand(Command command);
+
+/**
+ * Takes a command's redirections out of it, in a forked child
+ *
+ * For a replicated stage (|[N]): its splitter applies the input ones,
+ * its merger the output one, and each copy none, so childCommand()
+ * leaves the copies' stdin/stdout as they are.
+ *
+ * @param command  Command to take them from
+ * @param in  Non-zero to apply <, << and <<< to the current process
+ * @param out  Non-zero to apply >
+ *
+ * @return 0 on success, -1 if a redirection failed (already reported)
+ */
+extern int redirCommand(Command command, int in, int out);
+
+/**
+ * Expands a pipeline stage's words in the shell, rather than in its child
+ *
+ * So the stage's globs use (and fill) the shell's directory cache
+ * (Glob.h) rather than a copy the child throws away, and results
+ * (Results.h) can report each stage's arguments. Done again each time
+ * the stage is run, so a stage in a loop sees the variables as they are
+ * on that pass.
+ *
+ * @param command  Command to expand
+ *
+ * @return Its argv, or NULL for a group
+ */
+extern char **argsCommand(Command command);
 
 /**
  * Frees all memory associated with a Command
@@ -86,4 +210,53 @@ extern void freeCommand(Command command);
  */
 extern void freestateCommand();
 
+/**
+ * Switches to another set of per-session state (working directory
+ * bookkeeping and background processes)
+ *
+ * Lets several shell sessions in one process keep their own state.
+ *
+ * @param state  State returned by an earlier swapCommand(), or NULL for
+ *               a new one; it is taken over
+ *
+ * @return The state that was in use
+ */
+extern void *swapCommand(void *state);
+
+/**
+ * Frees state returned by swapCommand(), waiting for its background
+ * processes first
+ *
+ * @param state  State to free
+ */
+extern void dropCommand(void *state);
+
+/**
+ * Closes the coprocesses and waits for the background processes, as
+ * exit does
+ */
+extern void endCommand();
+
+/**
+ * Makes the shell a library, run by a program through sessions
+ *
+ * exec then refuses to replace (or redirect) the program, and the shell
+ * calls idle around the places it blocks waiting for children: idle(1)
+ * before, idle(0) after. Children forked don't.
+ *
+ * @param idle  Called with 1 when the shell is about to wait, so another
+ *              session may run meanwhile, and with 0 before it goes on
+ */
+extern void hostCommand(void (*idle)(int waiting));
+
+/**
+ * Tells the host program the shell is about to wait (1), or done (0)
+ *
+ * Not while the shell's own stdin/stdout are redirected for a builtin
+ * or group, which no other session may see.
+ *
+ * @param waiting  1 before a wait, 0 after it
+ */
+extern void idleCommand(int waiting);
+
 #endif
@@ -0,0 +1,386 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // strchrnul()
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <readline/readline.h>
+
+#include "Complete.h"
+#include "Glob.h"
+#include "Vars.h"
+#include "error.h"
+
+// Changes that rebuild the index
+#define EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+// How long to let a burst of changes (a package install) settle before rebuilding
+#define SETTLE 100
+
+// Executables in the directories of one PATH
+typedef struct
+{
+  char *path;
+  char **names; // sorted, without duplicates
+  int n;
+} *Index;
+
+// Shared with the index thread, under lock. The thread only uses plain
+// malloc(), never the shell's own modules (deq, Alloc), which aren't thread-safe
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t built = PTHREAD_COND_INITIALIZER;
+static pthread_t worker;
+static int started = 0;
+static int stop = 0;
+static Index latest = 0; // latest index built
+static char *want = 0;   // PATH the index is to be built from
+static int wake = -1;    // eventfd: want or stop changed
+
+static void freeIndex(Index x)
+{
+  if (!x)
+    return;
+  for (int i = 0; i < x->n; i++)
+    free(x->names[i]);
+  free(x->names);
+  free(x->path);
+  free(x);
+}
+
+static int cmpname(const void *a, const void *b)
+{
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+/**
+ * @brief Adds the executables in one directory to x
+ * @param size Allocated length of x->names, grown as needed
+ */
+static void scan(Index x, int *size, char *dir)
+{
+  DIR *d = opendir(*dir ? dir : ".");
+  if (!d)
+    return;
+  struct dirent *e;
+  while ((e = readdir(d)))
+  {
+    if (e->d_name[0] == '.' || e->d_type == DT_DIR)
+      continue;
+    struct stat st;
+    if (fstatat(dirfd(d), e->d_name, &st, 0) || !S_ISREG(st.st_mode) || !(st.st_mode & 0111) ||
+        faccessat(dirfd(d), e->d_name, X_OK, 0))
+      continue;
+    if (x->n == *size)
+    {
+      *size = *size ? *size * 2 : 1024;
+      x->names = realloc(x->names, sizeof(char *) * *size);
+      if (!x->names)
+        ERROR("realloc() failed");
+    }
+    x->names[x->n++] = strdup(e->d_name);
+  }
+  closedir(d);
+}
+
+/**
+ * @brief Builds the index of a PATH, watching its directories on notify
+ */
+static Index build(char *path, int notify)
+{
+  Index x = calloc(1, sizeof(*x));
+  if (!x)
+    ERROR("calloc() failed");
+  x->path = strdup(path);
+  int size = 0;
+  for (char *p = path;; p++)
+  {
+    char *end = strchrnul(p, ':');
+    char *dir = strndup(p, end - p);
+    // Watch before reading, so nothing added in between is missed
+    inotify_add_watch(notify, *dir ? dir : ".", EVENTS | IN_ONLYDIR);
+    scan(x, &size, dir);
+    free(dir);
+    if (!*end)
+      break;
+    p = end;
+  }
+  qsort(x->names, x->n, sizeof(char *), cmpname);
+  int n = 0;
+  for (int i = 0; i < x->n; i++)
+    if (n && !strcmp(x->names[n - 1], x->names[i]))
+      free(x->names[i]);
+    else
+      x->names[n++] = x->names[i];
+  x->n = n;
+  return x;
+}
+
+/**
+ * @brief The index thread: builds the index, then rebuilds it on every change
+ */
+static void *work(void *arg)
+{
+  char buf[4096];
+  for (;;)
+  {
+    pthread_mutex_lock(&lock);
+    if (stop)
+    {
+      pthread_mutex_unlock(&lock);
+      return 0;
+    }
+    char *path = strdup(want);
+    pthread_mutex_unlock(&lock);
+
+    // A fresh inotify instance per build drops the watches of the last one
+    int notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    Index x = build(path, notify);
+    free(path);
+    pthread_mutex_lock(&lock);
+    Index old = latest;
+    latest = x;
+    pthread_cond_broadcast(&built);
+    pthread_mutex_unlock(&lock);
+    freeIndex(old);
+
+    struct pollfd p[2] = {{notify, POLLIN, 0}, {wake, POLLIN, 0}};
+    while (poll(p, 2, -1) == -1)
+      ;
+    if (p[0].revents)
+    {
+      poll(p + 1, 1, SETTLE);
+      while (read(notify, buf, sizeof(buf)) > 0)
+        ;
+    }
+    if (p[1].revents)
+    {
+      unsigned long long n;
+      while (read(wake, &n, sizeof(n)) == -1 && errno == EINTR)
+        ;
+    }
+    close(notify);
+  }
+}
+
+// Wakes the index thread up to look at want and stop
+static void poke()
+{
+  unsigned long long one = 1;
+  while (write(wake, &one, sizeof(one)) == -1 && errno == EINTR)
+    ;
+}
+
+// fork() while the thread holds lock would leave the child's copy locked for good
+static void forking() { pthread_mutex_lock(&lock); }
+static void forked() { pthread_mutex_unlock(&lock); }
+
+// A forked child has no index thread, it starts its own if it completes anything
+static void child()
+{
+  started = 0;
+  close(wake);
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Asks for the index of the current PATH, starting the thread on first use
+ *
+ * Returns with lock held; the caller unlocks.
+ */
+static void request()
+{
+  static int atfork = 0;
+  char *path = getVar("PATH");
+  if (!path)
+    path = "";
+  pthread_mutex_lock(&lock);
+  if (!want || strcmp(want, path))
+  {
+    free(want);
+    want = strdup(path);
+    if (started)
+      poke();
+  }
+  if (started)
+    return;
+  if (!atfork++)
+    pthread_atfork(forking, forked, child);
+  // Signals are for the shell's own thread
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  wake = eventfd(0, EFD_CLOEXEC);
+  if (wake == -1 || pthread_create(&worker, 0, work, 0))
+    ERROR("can't start the completion index");
+  pthread_sigmask(SIG_SETMASK, &old, 0);
+  started = 1;
+}
+
+/**
+ * @brief Gets the index of the current PATH, waiting for it if need be
+ *
+ * Returns with lock held, so the index can't be replaced while it is
+ * read; the caller unlocks.
+ */
+static Index current()
+{
+  request();
+  while (!latest || strcmp(latest->path, want))
+    pthread_cond_wait(&built, &lock);
+  return latest;
+}
+
+// Completions being handed to readline, one per call of the generator
+static char **found = 0;
+static int nfound = 0;
+static int next = 0;
+
+static void add(char *dir, char *name)
+{
+  found = realloc(found, sizeof(char *) * (nfound + 1));
+  if (!found)
+    ERROR("realloc() failed");
+  if (asprintf(&found[nfound++], "%s%s", dir, name) == -1)
+    ERROR("asprintf() failed");
+}
+
+// First of the n sorted names that is not less than prefix
+static int first(char **names, int n, const char *prefix)
+{
+  int lo = 0, hi = n;
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (strcmp(names[mid], prefix) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/**
+ * @brief Collects the completions of text into found
+ */
+static void collect(int command, const char *text)
+{
+  for (int i = 0; i < nfound; i++)
+    free(found[i]);
+  nfound = next = 0;
+  size_t len;
+  if (command)
+  {
+    Index x = current();
+    len = strlen(text);
+    for (int i = first(x->names, x->n, text); i < x->n && !strncmp(x->names[i], text, len); i++)
+      add("", x->names[i]);
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+  const char *slash = strrchr(text, '/');
+  char *dir = slash ? strndup(text, slash - text + 1) : strdup("");
+  const char *base = slash ? slash + 1 : text;
+  len = strlen(base);
+  int n;
+  char **names = dirGlob(dir, &n);
+  for (int i = names ? first(names, n, base) : 0; names && i < n && !strncmp(names[i], base, len); i++)
+    if (names[i][0] != '.' || base[0] == '.')
+      add(dir, names[i]);
+  free(dir);
+}
+
+static char *generate(const char *text, int state)
+{
+  if (next == nfound)
+    return 0;
+  char *s = found[next];
+  found[next++] = 0;
+  return s;
+}
+
+/**
+ * @brief Whether the word at start is where a command name goes
+ *
+ * That is the start of the line, or after an operator (the scanner
+ * only splits on whitespace, so operators are words of their own).
+ */
+static int commandword(int start)
+{
+  static char *ops[] = {"|", "|&", ";", "&", "&&", "||", "(", "{", 0};
+  int end = start;
+  while (end > 0 && (rl_line_buffer[end - 1] == ' ' || rl_line_buffer[end - 1] == '\t'))
+    end--;
+  if (!end)
+    return 1;
+  int begin = end;
+  while (begin > 0 && rl_line_buffer[begin - 1] != ' ' && rl_line_buffer[begin - 1] != '\t')
+    begin--;
+  for (char **op = ops; *op; op++)
+    if ((int)strlen(*op) == end - begin && !strncmp(rl_line_buffer + begin, *op, end - begin))
+      return 1;
+  return 0;
+}
+
+static char **complete(const char *text, int start, int end)
+{
+  int command = commandword(start) && !strchr(text, '/');
+  collect(command, text);
+  // Lets readline add / after a directory, and quote nothing
+  rl_filename_completion_desired = !command;
+  rl_attempted_completion_over = 1;
+  return rl_completion_matches(text, generate);
+}
+
+// Starts building the index once the first prompt is up
+static int prompted()
+{
+  rl_pre_input_hook = 0;
+  request();
+  pthread_mutex_unlock(&lock);
+  return 0;
+}
+
+extern void initComplete()
+{
+  rl_attempted_completion_function = complete;
+  rl_pre_input_hook = prompted;
+}
+
+extern int printComplete(FILE *f, int command, char *prefix)
+{
+  collect(command, prefix);
+  for (int i = 0; i < nfound; i++)
+    fprintf(f, "%s\n", found[i]);
+  return nfound;
+}
+
+extern void freeComplete()
+{
+  for (int i = 0; i < nfound; i++)
+    free(found[i]);
+  free(found);
+  found = 0;
+  nfound = next = 0;
+  if (!started)
+    return;
+  pthread_mutex_lock(&lock);
+  stop = 1;
+  pthread_mutex_unlock(&lock);
+  poke();
+  pthread_join(worker, 0);
+  close(wake);
+  freeIndex(latest);
+  free(want);
+  latest = 0;
+  want = 0;
+  started = stop = 0;
+}
@@ -0,0 +1,42 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include <stdio.h>
+
+/**
+ * Tab completion of command names and file names
+ *
+ * The first word of a command completes from an index of the
+ * executables in PATH: a sorted array of their names, searched by
+ * binary search for the range with the typed prefix. It is built by a
+ * thread started once the first prompt is shown, so startup doesn't
+ * wait for it, and rebuilt by that thread whenever inotify reports a
+ * change in one of the PATH directories or PATH itself changes. A Tab
+ * pressed before the first build has finished waits for it.
+ *
+ * Other words complete as file names, listed through the directory
+ * cache that glob expansion uses (see dirGlob()).
+ */
+
+/**
+ * @brief Installs completion in readline, for an interactive shell
+ * @return VOID
+ */
+extern void initComplete();
+
+/**
+ * @brief Prints the completions of a prefix, one per line
+ * @param f Stream to print to
+ * @param command Non-zero to complete a command name, 0 for a file name
+ * @param prefix Text to complete
+ * @return Number of completions printed
+ */
+extern int printComplete(FILE *f, int command, char *prefix);
+
+/**
+ * @brief Stops the index thread and frees the index
+ * @return VOID
+ */
+extern void freeComplete();
+
+#endif
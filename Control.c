@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Control.h"
+#include "Vars.h"
+#include "Glob.h"
+#include "deq.h"
+#include "error.h"
+
+enum
+{
+  IF,
+  WHILE,
+  FOR
+};
+
+typedef struct
+{
+  int kind;
+  Sequence cond;  // if and while
+  Sequence body;  // then part, or loop body
+  Sequence other; // else part, or 0
+  char *name;     // for NAME
+  char **words;   // for NAME in WORDS, unexpanded
+} *ControlRep;
+
+extern Control newControl(T_control t, Sequence cond, Sequence body, Sequence other)
+{
+  ControlRep r = malloc(sizeof(*r));
+  if (!r)
+    ERROR("malloc() failed");
+  r->kind = !strcmp(t->kind, "if") ? IF : !strcmp(t->kind, "while") ? WHILE : FOR;
+  r->cond = cond;
+  r->body = body;
+  r->other = other;
+  r->name = t->name ? strdup(t->name->s) : 0;
+  int n = 0;
+  for (T_words w = t->words; w; w = w->words)
+    n++;
+  r->words = malloc(sizeof(char *) * (n + 1));
+  if (!r->words)
+    ERROR("malloc() failed");
+  n = 0;
+  for (T_words w = t->words; w; w = w->words)
+    r->words[n++] = strdup(w->word->s);
+  r->words[n] = 0;
+  return r;
+}
+
+/**
+ * @brief Runs a for loop: expands the words once, then the body for each
+ */
+static int loop(ControlRep r, Jobs jobs, int *eof)
+{
+  Deq items = deq_new();
+  for (char **w = r->words; *w; w++)
+  {
+    char *a = expandVars(*w);
+    if (*a || !strchr(*w, '$'))
+      expandGlob(a, items);
+    free(a);
+  }
+  int status = 0;
+  while (deq_len(items))
+  {
+    char *item = deq_head_get(items);
+    if (!*eof)
+    {
+      setVar(r->name, item);
+      status = runSequence(r->body, jobs, eof);
+    }
+    free(item);
+  }
+  deq_del(items, 0);
+  return status;
+}
+
+extern int execControl(Control control, Jobs jobs, int *eof)
+{
+  ControlRep r = control;
+  int status = 0;
+  switch (r->kind)
+  {
+  case IF:
+    if (!runSequence(r->cond, jobs, eof))
+      status = runSequence(r->body, jobs, eof);
+    else if (r->other && !*eof)
+      status = runSequence(r->other, jobs, eof);
+    break;
+  case WHILE:
+    while (!*eof && !runSequence(r->cond, jobs, eof) && !*eof)
+      status = runSequence(r->body, jobs, eof);
+    break;
+  case FOR:
+    status = loop(r, jobs, eof);
+    break;
+  }
+  return status;
+}
+
+extern void freeControl(Control control)
+{
+  ControlRep r = control;
+  if (r->cond)
+    freeSequence(r->cond);
+  freeSequence(r->body);
+  if (r->other)
+    freeSequence(r->other);
+  for (char **w = r->words; *w; w++)
+    free(*w);
+  free(r->words);
+  free(r->name);
+  free(r);
+}
@@ -0,0 +1,52 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+typedef void *Control;
+
+#include "Tree.h"
+#include "Jobs.h"
+#include "Sequence.h"
+
+/**
+ * Compound commands: if, while and for
+ *
+ * The parts of a compound command are sequences built once, when the
+ * line is interpreted, and run as plans: runSequence() leaves them as
+ * they are, so a loop body goes round without being scanned, parsed or
+ * built again. Only the words of its commands are expanded again on
+ * each run, so variables set by the loop are seen.
+ */
+
+/**
+ * @brief Creates a compound command from its parse tree and its built parts
+ * @param t Tree node, for the kind and a for loop's NAME and WORDS (copied)
+ * @param cond Condition of an if or while, or NULL
+ * @param body Then part, or loop body
+ * @param other Else part, or NULL
+ * @return New Control, owning the sequences
+ */
+extern Control newControl(T_control t, Sequence cond, Sequence body, Sequence other);
+
+/**
+ * @brief Runs a compound command
+ *
+ * if runs its then part if the condition's status is 0, else its else
+ * part; while runs its body for as long as the condition's status is 0;
+ * for expands its words (variables, braces, patterns) and runs its body
+ * with NAME set to each in turn. A loop ends early if the shell exits.
+ *
+ * @param control Compound command
+ * @param jobs Job table for background pipelines in it
+ * @param eof Set by exit
+ * @return Status of the last pipeline run in a part, 0 if none ran
+ */
+extern int execControl(Control control, Jobs jobs, int *eof);
+
+/**
+ * @brief Frees a compound command and its parts
+ * @param control Compound command
+ * @return VOID
+ */
+extern void freeControl(Control control);
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // pipe2()
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "Coproc.h"
+#include "Pipeline.h"
+#include "Vars.h"
+#include "Prio.h"
+#include "Stats.h"
+#include "deq.h"
+#include "error.h"
+
+extern char **environ;
+
+typedef struct
+{
+  char *name;
+  int pid;
+  int fd[2]; // the shell's ends: read its output, write its input
+} *Coproc;
+
+// Coprocesses not reaped yet
+static Deq coprocs = 0;
+
+static int identifier(char *s)
+{
+  if (!isalpha((unsigned char)*s) && *s != '_')
+    return 0;
+  for (; *s; s++)
+    if (!isalnum((unsigned char)*s) && *s != '_')
+      return 0;
+  return 1;
+}
+
+static Coproc find(char *name, int pid)
+{
+  for (int i = 0; coprocs && i < deq_len(coprocs); i++)
+  {
+    Coproc c = deq_head_ith(coprocs, i);
+    if (name ? !strcmp(c->name, name) : c->pid == pid)
+      return c;
+  }
+  return 0;
+}
+
+// Sets NAME<suffix> to n
+static void set(char *name, char *suffix, int n)
+{
+  char *var, value[16];
+  if (asprintf(&var, "%s%s", name, suffix) == -1)
+    ERROR("asprintf() failed");
+  snprintf(value, sizeof(value), "%d", n);
+  setVar(var, value);
+  free(var);
+}
+
+static void unset(char *name, char *suffix)
+{
+  char *var;
+  if (asprintf(&var, "%s%s", name, suffix) == -1)
+    ERROR("asprintf() failed");
+  unsetVar(var);
+  free(var);
+}
+
+static void shut(Coproc c)
+{
+  for (int i = 0; i < 2; i++)
+    if (c->fd[i] != -1)
+    {
+      close(c->fd[i]);
+      c->fd[i] = -1;
+    }
+}
+
+extern int newCoproc(char *name, char **argv, Jobs jobs)
+{
+  if (!identifier(name) || find(name, 0))
+    return -1;
+  int in[2], out[2];
+  if (pipe2(in, O_CLOEXEC) == -1 || pipe2(out, O_CLOEXEC) == -1)
+    ERROR("pipe2() failed");
+  countStats(ST_PIPES);
+  countStats(ST_PIPES);
+
+  // Build the exec environment in the shell, as for any command
+  envVars();
+  fflush(stdout);
+  int pid = fork();
+  if (pid == -1)
+    ERROR("fork() failed");
+  if (!pid)
+  {
+    // Every other end is close-on-exec
+    if (dup2(in[0], STDIN_FILENO) == -1 || dup2(out[1], STDOUT_FILENO) == -1)
+      ERROR("dup2() failed");
+    bgPrio();
+    environ = envVars();
+    execvp(argv[0], argv);
+    countStats(ST_EXECFAIL);
+    // Not exit(): the atexit() handlers are the shell's, or its host program's
+    ERRORLOC(__FILE__, __LINE__, "error", "%s", "execvp() failed");
+    _exit(EXIT_FAILURE);
+  }
+  forkStats(pid);
+  close(in[0]);
+  close(out[1]);
+
+  // Out of the way of redirections to 0-9
+  Coproc c = malloc(sizeof(*c));
+  if (!c || !(c->name = strdup(name)))
+    ERROR("malloc() failed");
+  c->pid = pid;
+  c->fd[0] = fcntl(out[0], F_DUPFD_CLOEXEC, 10);
+  c->fd[1] = fcntl(in[1], F_DUPFD_CLOEXEC, 10);
+  if (c->fd[0] == -1 || c->fd[1] == -1)
+    ERROR("fcntl() failed");
+  close(out[0]);
+  close(in[1]);
+  if (!coprocs)
+    coprocs = deq_new();
+  deq_tail_put(coprocs, c);
+
+  set(name, "", c->fd[0]);
+  set(name, "[0]", c->fd[0]);
+  set(name, "[1]", c->fd[1]);
+  set(name, "_PID", pid);
+
+  Pipeline job = newPipeline(0);
+  pidPipeline(job, pid);
+  addJobs(jobs, job);
+  return 0;
+}
+
+extern void exitCoproc(int pid)
+{
+  Coproc c = find(0, pid);
+  if (!c)
+    return;
+  deq_head_rem(coprocs, c);
+  shut(c);
+  unset(c->name, "");
+  unset(c->name, "[0]");
+  unset(c->name, "[1]");
+  unset(c->name, "_PID");
+  free(c->name);
+  free(c);
+}
+
+extern void closeCoproc()
+{
+  for (int i = 0; coprocs && i < deq_len(coprocs); i++)
+    shut(deq_head_ith(coprocs, i));
+}
+
+static void freeOne(Data d)
+{
+  Coproc c = d;
+  shut(c);
+  free(c->name);
+  free(c);
+}
+
+extern void freeCoproc()
+{
+  if (coprocs)
+    deq_del(coprocs, freeOne);
+  coprocs = 0;
+}
+
+extern void *swapCoproc(void *state)
+{
+  Deq old = coprocs;
+  coprocs = state;
+  return old;
+}
@@ -0,0 +1,71 @@
+#ifndef COPROC_H
+#define COPROC_H
+
+#include "Jobs.h"
+
+/**
+ * Coprocesses: coproc NAME command [args...]
+ *
+ * Starts a command once, in the background, with its stdin and stdout
+ * on pipes to the shell, so a script can keep one warm helper and talk
+ * to it rather than start a new one for every query:
+ *
+ *   coproc CALC bc
+ *   echo 6*7 >&${CALC[1]}
+ *   head -n 1 <&${CALC[0]}
+ *
+ * The shell keeps its ends of the pipes as descriptors 10 and up,
+ * close-on-exec, so only commands redirected to them (<&N, >&N) get
+ * them, and sets
+ *
+ *   NAME, NAME[0]   descriptor to read the coprocess's output from
+ *   NAME[1]         descriptor to write its input to
+ *   NAME_PID        its process
+ *
+ * The command is run as a program, not a builtin. The coprocess is a
+ * job, which fg can bring to the foreground. Once it has been reaped
+ * the shell closes both descriptors and unsets the variables, and NAME
+ * can be used again. Its output is only ever read by the commands given
+ * its descriptor: one that reads ahead (head does) may take more than
+ * the answer it waits for, so ask, then read.
+ */
+
+/**
+ * @brief Starts a coprocess
+ * @param name NAME of its variables
+ * @param argv Command and arguments, already expanded
+ * @param jobs Job table to add it to
+ * @return 0, or -1 if name isn't a variable name or a coprocess still has it
+ */
+extern int newCoproc(char *name, char **argv, Jobs jobs);
+
+/**
+ * @brief Closes a reaped coprocess's descriptors and unsets its variables
+ * @param pid Process reaped, which needn't be a coprocess
+ * @return VOID
+ */
+extern void exitCoproc(int pid);
+
+/**
+ * @brief Closes every coprocess's descriptors, so they see end of file
+ *
+ * For exit, before it waits for them.
+ *
+ * @return VOID
+ */
+extern void closeCoproc();
+
+/**
+ * @brief Frees what is kept of coprocesses not reaped
+ * @return VOID
+ */
+extern void freeCoproc();
+
+/**
+ * @brief Switches to another session's coprocesses
+ * @param state State returned by an earlier swapCoproc(), or NULL for none
+ * @return The state that was in use
+ */
+extern void *swapCoproc(void *state);
+
+#endif
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "Deadline.h"
+#include "Command.h"
+#include "error.h"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+// Time between SIGTERM and SIGKILL, for the stages to clean up
+#define GRACE 2000
+// How often stages without a pidfd (kernels before 5.3) are checked
+#define TICK 10
+
+// Default deadline, 0 for none
+static long deadline = 0;
+
+extern long parseDeadline(char *s)
+{
+  char *end;
+  double v = strtod(s, &end);
+  if (end == s || !(v > 0) || v > 1e9)
+    return -1;
+  double scale;
+  if (!*end || !strcmp(end, "s"))
+    scale = 1000;
+  else if (!strcmp(end, "ms"))
+    scale = 1;
+  else if (!strcmp(end, "m"))
+    scale = 60000;
+  else if (!strcmp(end, "h"))
+    scale = 3600000;
+  else
+    return -1;
+  long ms = v * scale + 0.5;
+  return ms ? ms : 1;
+}
+
+extern void setDeadline(long ms)
+{
+  deadline = ms;
+}
+
+extern long getDeadline()
+{
+  return deadline;
+}
+
+extern void printDeadline(FILE *f)
+{
+  if (deadline)
+    fprintf(f, "%gs\n", deadline / 1000.0);
+  else
+    fprintf(f, "off\n");
+}
+
+/**
+ * @brief Hands the terminal, if we read from one, to a process group
+ */
+static void terminal(pid_t group)
+{
+  if (!isatty(STDIN_FILENO))
+    return;
+  // Asking from outside the terminal's group would stop us otherwise
+  void (*old)(int) = signal(SIGTTOU, SIG_IGN);
+  tcsetpgrp(STDIN_FILENO, group);
+  signal(SIGTTOU, old);
+}
+
+extern void joinDeadline(int pid, int group)
+{
+  setpgid(pid, group ? group : pid);
+  terminal(group ? group : pid ? pid : getpid());
+}
+
+static long now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Whether a stage has exited (and can be reaped without blocking)
+ */
+static int exited(int pid, int fd, struct pollfd *p)
+{
+  if (fd >= 0)
+    return p && p->revents;
+  siginfo_t info;
+  info.si_pid = 0;
+  return !waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) && info.si_pid == pid;
+}
+
+/**
+ * @brief Reaps stages as they exit, until all have or it is time end
+ *
+ * @param fd Each stage's pidfd, -1 if it has none, -2 once reaped
+ * @param result Set to the exit status of stage status, when it is reaped
+ * @return Number of stages still running
+ */
+static int until(int *pids, int *fd, int n, int status, int *result, long end)
+{
+  struct pollfd *p = malloc(sizeof(*p) * n);
+  int *at = malloc(sizeof(int) * n); // stage -> its entry in p, or -1
+  if (!p || !at)
+    ERROR("malloc() failed");
+  int left;
+  for (;;)
+  {
+    int k = 0, ticking = 0;
+    left = 0;
+    for (int i = 0; i < n; i++)
+    {
+      at[i] = -1;
+      if (fd[i] == -2)
+        continue;
+      left++;
+      if (fd[i] == -1)
+        ticking = 1;
+      else
+      {
+        at[i] = k;
+        p[k].fd = fd[i];
+        p[k++].events = POLLIN;
+      }
+    }
+    long wait = end - now();
+    if (!left || wait <= 0)
+      break;
+    if (ticking && wait > TICK)
+      wait = TICK;
+    idleCommand(1);
+    int polled = poll(p, k, wait);
+    idleCommand(0);
+    if (polled == -1)
+      continue;
+    for (int i = 0; i < n; i++)
+      if (fd[i] != -2 && exited(pids[i], fd[i], at[i] >= 0 ? &p[at[i]] : 0))
+      {
+        int s = waitCommand(pids[i]);
+        if (i == status)
+          *result = s;
+        if (fd[i] >= 0)
+          close(fd[i]);
+        fd[i] = -2;
+      }
+  }
+  free(p);
+  free(at);
+  return left;
+}
+
+/**
+ * @brief Gets the name of the program a process is running
+ */
+static void comm(int pid, char *name, size_t size)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+  FILE *f = fopen(path, "re");
+  if (!f || !fgets(name, size, f))
+    snprintf(name, size, "?");
+  else
+    name[strcspn(name, "\n")] = 0;
+  if (f)
+    fclose(f);
+}
+
+extern int waitDeadline(int *pids, int n, int status, long ms)
+{
+  int *fd = malloc(sizeof(int) * n);
+  if (!fd)
+    ERROR("malloc() failed");
+  for (int i = 0; i < n; i++)
+    if ((fd[i] = syscall(SYS_pidfd_open, pids[i], 0)) < 0)
+      fd[i] = -1;
+
+  int result = 0;
+  if (until(pids, fd, n, status, &result, now() + ms))
+  {
+    for (int i = 0; i < n; i++)
+      if (fd[i] != -2)
+      {
+        char name[32];
+        comm(pids[i], name, sizeof(name));
+        fprintf(stderr, "timeout: stage %d (%s) still running after %gs\n", i + 1, name, ms / 1000.0);
+      }
+    // The first stage started the group, which outlives it while any member is left
+    kill(-pids[0], SIGTERM);
+    kill(-pids[0], SIGCONT); // a stopped stage only sees SIGTERM once it runs
+    if (until(pids, fd, n, status, &result, now() + GRACE))
+    {
+      kill(-pids[0], SIGKILL);
+      for (int i = 0; i < n; i++)
+        if (fd[i] != -2)
+        {
+          waitCommand(pids[i]);
+          if (fd[i] >= 0)
+            close(fd[i]);
+        }
+    }
+    result = 124;
+  }
+  free(fd);
+  terminal(getpgrp());
+  return result;
+}
@@ -0,0 +1,80 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <stdio.h>
+
+/**
+ * Deadlines for foreground pipelines
+ *
+ *   timeout DURATION pipeline   runs pipeline with a deadline
+ *   timeout [DURATION | off]    sets (or shows) the default deadline
+ *
+ * A DURATION is a number of seconds, possibly fractional, or a number
+ * with a unit: 500ms, 30s, 5m, 1h. A pipeline with a deadline runs in a
+ * process group of its own, and the shell waits for its stages by
+ * poll()ing their pidfds. When the deadline passes, the stages still
+ * running are reported on stderr, the group gets SIGTERM, and whatever
+ * is left of it a grace period later gets SIGKILL. The pipeline's
+ * status is then 124, as with timeout(1).
+ *
+ * Background pipelines and builtins run in the shell process are not
+ * timed.
+ */
+
+/**
+ * @brief Parses a duration
+ * @param s Duration such as 2.5, 500ms, 30s, 5m, 1h
+ * @return Milliseconds (> 0), or -1 if s isn't a duration
+ */
+extern long parseDeadline(char *s);
+
+/**
+ * @brief Sets the default deadline of foreground pipelines
+ * @param ms Milliseconds, 0 for none
+ * @return VOID
+ */
+extern void setDeadline(long ms);
+
+/**
+ * @brief Gets the default deadline
+ * @return Milliseconds, 0 for none
+ */
+extern long getDeadline();
+
+/**
+ * @brief Prints the default deadline, as timeout takes it
+ * @param f Stream to print to
+ * @return VOID
+ */
+extern void printDeadline(FILE *f);
+
+/**
+ * @brief Puts a forked child in the process group of a timed pipeline
+ *
+ * Called in the child, before anything else, and also by the shell for
+ * the child, so the group exists whichever runs first. The first stage
+ * starts the group. An interactive shell's terminal goes to the group,
+ * so ^C reaches it.
+ *
+ * @param pid Child, or 0 in the child itself
+ * @param group Process group, 0 to start one
+ * @return VOID
+ */
+extern void joinDeadline(int pid, int group);
+
+/**
+ * @brief Waits for the stages of a timed pipeline, up to a deadline
+ *
+ * Stages that haven't finished by then are reported by number and the
+ * program they run, and their process
+ * group is killed (SIGTERM, then SIGKILL) and reaped.
+ *
+ * @param pids Stages, in the order forked; each one is reaped
+ * @param n Number of stages
+ * @param status Index of the stage whose exit status is the pipeline's
+ * @param ms Deadline, in milliseconds from now
+ * @return Exit status of stage status, or 124 if the deadline passed
+ */
+extern int waitDeadline(int *pids, int n, int status, long ms);
+
+#endif
@@ -0,0 +1,378 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // asprintf()
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "Glob.h"
+#include "deq.h"
+#include "error.h"
+
+// Cache bounds: directories kept, and names kept over all of them
+#define MAXDIRS 32
+#define MAXNAMES (1 << 20)
+
+// One cached directory listing
+typedef struct
+{
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  int racy;    // listed in the same second it was modified, may be stale
+  int n;       // number of names
+  char **names; // sorted, pointing into buf
+  char *buf;
+} *Dir;
+
+typedef struct
+{
+  Deq dirs;  // most recently used first
+  long names; // names over all cached listings
+  long hits;
+  long misses;
+  long evictions;
+} *CacheRep;
+
+static CacheRep cache = 0;
+
+static void freeDir(Data d)
+{
+  Dir dir = d;
+  free(dir->names);
+  free(dir->buf);
+  free(dir);
+}
+
+static int cmpname(const void *a, const void *b)
+{
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+/**
+ * @brief Reads a directory into a sorted listing
+ * @return New listing, or 0 if the directory can't be read
+ */
+static Dir readDir(char *path, struct stat *st)
+{
+  DIR *d = opendir(path);
+  if (!d)
+    return 0;
+  Dir dir = malloc(sizeof(*dir));
+  size_t len = 0, size = 4096;
+  char *buf = malloc(size);
+  if (!dir || !buf)
+    ERROR("malloc() failed");
+  int n = 0;
+  struct dirent *e;
+  while ((e = readdir(d)))
+  {
+    if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+      continue;
+    size_t m = strlen(e->d_name) + 1;
+    if (len + m > size)
+    {
+      while (len + m > size)
+        size *= 2;
+      buf = realloc(buf, size);
+      if (!buf)
+        ERROR("realloc() failed");
+    }
+    memcpy(buf + len, e->d_name, m);
+    len += m;
+    n++;
+  }
+  closedir(d);
+  // Names are packed in buf, point at each one and sort
+  dir->names = malloc(sizeof(char *) * (n + 1));
+  if (!dir->names)
+    ERROR("malloc() failed");
+  char *p = buf;
+  for (int i = 0; i < n; i++, p += strlen(p) + 1)
+    dir->names[i] = p;
+  dir->names[n] = 0;
+  qsort(dir->names, n, sizeof(char *), cmpname);
+  dir->buf = buf;
+  dir->n = n;
+  dir->dev = st->st_dev;
+  dir->ino = st->st_ino;
+  dir->mtime = st->st_mtim;
+  dir->racy = st->st_mtim.tv_sec >= time(0) - 1;
+  return dir;
+}
+
+extern char **dirGlob(char *path, int *n)
+{
+  if (!cache)
+  {
+    cache = calloc(1, sizeof(*cache));
+    if (!cache)
+      ERROR("calloc() failed");
+    cache->dirs = deq_new();
+  }
+  if (!*path)
+    path = ".";
+  struct stat st;
+  if (stat(path, &st) || !S_ISDIR(st.st_mode))
+    return 0;
+
+  // The same directory (dev/ino), unchanged since it was listed, is a hit
+  Dir dir = 0;
+  for (int i = 0; i < deq_len(cache->dirs); i++)
+  {
+    Dir d = deq_head_ith(cache->dirs, i);
+    if (d->dev == st.st_dev && d->ino == st.st_ino)
+    {
+      dir = d;
+      break;
+    }
+  }
+  if (dir && !dir->racy && dir->mtime.tv_sec == st.st_mtim.tv_sec &&
+      dir->mtime.tv_nsec == st.st_mtim.tv_nsec)
+  {
+    cache->hits++;
+    deq_head_rem(cache->dirs, dir);
+    deq_head_put(cache->dirs, dir);
+    *n = dir->n;
+    return dir->names;
+  }
+  cache->misses++;
+  if (dir)
+  {
+    deq_head_rem(cache->dirs, dir);
+    cache->names -= dir->n;
+    freeDir(dir);
+  }
+  dir = readDir(path, &st);
+  if (!dir)
+    return 0;
+  deq_head_put(cache->dirs, dir);
+  cache->names += dir->n;
+
+  // Evict least recently used listings, but always keep this one
+  while (deq_len(cache->dirs) > 1 &&
+         (deq_len(cache->dirs) > MAXDIRS || cache->names > MAXNAMES))
+  {
+    Dir old = deq_tail_get(cache->dirs);
+    cache->names -= old->n;
+    cache->evictions++;
+    freeDir(old);
+  }
+  *n = dir->n;
+  return dir->names;
+}
+
+static int magic(char *s)
+{
+  return strpbrk(s, "*?[") != 0;
+}
+
+/**
+ * @brief Matches the pattern components in rest against the file system under dir
+ *
+ * @param dir Path matched so far, "" or ending in '/'
+ * @param rest Remaining pattern, components separated by '/'
+ * @param found Matching paths are appended here
+ */
+static void walk(char *dir, char *rest, Deq found)
+{
+  char *slash = strchr(rest, '/');
+  int len = slash ? slash - rest : (int)strlen(rest);
+  char *next = slash ? slash + 1 : 0;
+  char *comp = strndup(rest, len);
+  char *path;
+
+  if (!magic(comp))
+  {
+    // Literal component, just needs to exist
+    if (asprintf(&path, "%s%s", dir, comp) == -1)
+      ERROR("asprintf() failed");
+    struct stat st;
+    if (!next && !lstat(path, &st))
+      deq_tail_put(found, path);
+    else
+    {
+      if (next && !stat(path, &st) && S_ISDIR(st.st_mode))
+      {
+        char *sub;
+        if (asprintf(&sub, "%s/", path) == -1)
+          ERROR("asprintf() failed");
+        walk(sub, next, found);
+        free(sub);
+      }
+      free(path);
+    }
+    free(comp);
+    return;
+  }
+
+  // Copy the matches out first, the listing is only valid until the next lookup
+  int n;
+  char **names = dirGlob(dir, &n);
+  Deq matches = deq_new();
+  for (int i = 0; names && i < n; i++)
+    if (!fnmatch(comp, names[i], FNM_PERIOD))
+    {
+      if (asprintf(&path, "%s%s", dir, names[i]) == -1)
+        ERROR("asprintf() failed");
+      deq_tail_put(matches, path);
+    }
+  free(comp);
+  while (deq_len(matches))
+  {
+    path = deq_head_get(matches);
+    struct stat st;
+    if (!next)
+      deq_tail_put(found, path);
+    else
+    {
+      if (!stat(path, &st) && S_ISDIR(st.st_mode))
+      {
+        char *sub;
+        if (asprintf(&sub, "%s/", path) == -1)
+          ERROR("asprintf() failed");
+        walk(sub, next, found);
+        free(sub);
+      }
+      free(path);
+    }
+  }
+  deq_del(matches, 0);
+}
+
+/**
+ * @brief Pathname expansion of one (brace expanded) word
+ */
+static void glob(char *word, Deq args)
+{
+  if (!magic(word))
+  {
+    deq_tail_put(args, strdup(word));
+    return;
+  }
+  Deq found = deq_new();
+  if (*word == '/')
+    walk("/", word + 1, found);
+  else
+    walk("", word, found);
+  if (!deq_len(found))
+    deq_tail_put(args, strdup(word)); // no match, keep the pattern
+  while (deq_len(found))
+    deq_tail_put(args, deq_head_get(found));
+  deq_del(found, 0);
+}
+
+/**
+ * @brief Brace expansion, then pathname expansion of each result
+ *
+ * Expands the first {a,b} or {m..n} in the word, recursing on each
+ * alternative so later (and nested) braces are expanded too. ${ is not a
+ * brace, and braces without a comma or range are kept as they are.
+ */
+static void braces(char *word, Deq args)
+{
+  for (char *open = word; (open = strchr(open, '{')); open++)
+  {
+    if (open > word && open[-1] == '$')
+      continue;
+    // Find the matching close brace and the top-level commas
+    int depth = 0, commas = 0;
+    char *close;
+    for (close = open; *close; close++)
+    {
+      if (*close == '{')
+        depth++;
+      else if (*close == '}' && !--depth)
+        break;
+      else if (*close == ',' && depth == 1)
+        commas++;
+    }
+    if (!*close)
+      break;
+
+    char *pre = strndup(word, open - word);
+    char *body = strndup(open + 1, close - open - 1);
+    char *post = close + 1;
+    char *alt, *w;
+    long lo, hi;
+    char end;
+    if (commas)
+    {
+      // {a,b,c}: split body at top-level commas
+      depth = 0;
+      alt = body;
+      for (char *p = body;; p++)
+      {
+        if (*p == '{')
+          depth++;
+        else if (*p == '}')
+          depth--;
+        if ((*p == ',' && !depth) || !*p)
+        {
+          char c = *p;
+          *p = 0;
+          if (asprintf(&w, "%s%s%s", pre, alt, post) == -1)
+            ERROR("asprintf() failed");
+          braces(w, args);
+          free(w);
+          if (!c)
+            break;
+          alt = p + 1;
+        }
+      }
+    }
+    else if (sscanf(body, "%ld..%ld%c", &lo, &hi, &end) == 2)
+    {
+      // {m..n}: numeric range, either direction
+      for (long i = lo;; i += lo <= hi ? 1 : -1)
+      {
+        if (asprintf(&w, "%s%ld%s", pre, i, post) == -1)
+          ERROR("asprintf() failed");
+        braces(w, args);
+        free(w);
+        if (i == hi)
+          break;
+      }
+    }
+    else
+    {
+      free(pre);
+      free(body);
+      continue; // not a brace expression, keep looking
+    }
+    free(pre);
+    free(body);
+    return;
+  }
+  glob(word, args);
+}
+
+extern void expandGlob(char *word, Deq args)
+{
+  braces(word, args);
+}
+
+extern void statGlob(FILE *f)
+{
+  long hits = cache ? cache->hits : 0;
+  long misses = cache ? cache->misses : 0;
+  long lookups = hits + misses;
+  fprintf(f, "dirs %d/%d names %ld/%d hits %ld misses %ld evictions %ld hit rate %.1f%%\n",
+          cache ? deq_len(cache->dirs) : 0, MAXDIRS,
+          cache ? cache->names : 0, MAXNAMES,
+          hits, misses, cache ? cache->evictions : 0,
+          lookups ? 100.0 * hits / lookups : 0.0);
+}
+
+extern void freeGlob()
+{
+  if (!cache)
+    return;
+  deq_del(cache->dirs, freeDir);
+  free(cache);
+  cache = 0;
+}
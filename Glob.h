@@ -0,0 +1,53 @@
+#ifndef GLOB_H
+#define GLOB_H
+
+#include <stdio.h>
+
+#include "deq.h"
+
+/**
+ * Pathname and brace expansion, backed by a cache of directory listings
+ *
+ * Listings are cached by path and checked against the directory's mtime
+ * before use, so repeated globs over the same (large) directory don't
+ * re-read it. The cache holds a bounded number of directories and names,
+ * evicting the least recently used listing first. Every command's words
+ * are expanded in the shell, pipeline stages' included (argsCommand()),
+ * so the cache lasts across commands.
+ */
+
+/**
+ * @brief Expands braces ({a,b}, {1..3}) and patterns (*, ?, [...]) in a word
+ *
+ * A pattern that matches nothing is kept as is.
+ *
+ * @param word Word to expand (not modified)
+ * @param args Newly allocated expansions are appended here, in order
+ * @return VOID
+ */
+extern void expandGlob(char *word, Deq args);
+
+/**
+ * @brief Lists a directory through the cache
+ *
+ * @param path Directory to list ("" means the current directory)
+ * @param n Set to the number of names
+ * @return Sorted names (without . and ..), owned by the cache and valid
+ *         until the next call into this module, or NULL if unreadable
+ */
+extern char **dirGlob(char *path, int *n);
+
+/**
+ * @brief Prints directory cache statistics (size, hits, misses, hit rate)
+ * @param f Stream to print to
+ * @return VOID
+ */
+extern void statGlob(FILE *f);
+
+/**
+ * @brief Frees the directory cache
+ * @return VOID
+ */
+extern void freeGlob();
+
+#endif
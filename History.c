@@ -0,0 +1,340 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memfd_create(), memmem()
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <readline/history.h>
+
+#include "History.h"
+#include "error.h"
+
+// Entries handed to readline at startup, and kept there for line editing
+#define LOAD 500
+
+// First 8 bytes of an index file
+#define MAGIC "HISTIDX1"
+
+typedef struct
+{
+  int log;        // the commands, one per line
+  int idx;        // MAGIC, then the starting offset of every line
+  long n;         // number of entries, as of the last count()
+  uint64_t end;   // log bytes covered by the index
+  char *map;      // log, mapped when read
+  size_t maplen;  // bytes of log mapped
+  char *imap;     // index, mapped when read
+  size_t imaplen; // bytes of index mapped
+} *HistoryRep;
+
+static HistoryRep hist = 0;
+
+/**
+ * @brief Counts the entries, from the size of the index
+ *
+ * Other shells sharing the files append to it too, so a count kept by
+ * this one alone would go stale.
+ *
+ * @return Number of entries
+ */
+static long count()
+{
+  struct stat st;
+  if (fstat(hist->idx, &st) || st.st_size < (off_t)sizeof(MAGIC) - 1)
+    return 0;
+  return (st.st_size - (sizeof(MAGIC) - 1)) / sizeof(uint64_t);
+}
+
+/**
+ * @brief Makes sure the mapped log and index cover every entry, this shell's or not
+ * @return 0 if there are entries to read, -1 if not
+ */
+static int map()
+{
+  if (!hist || !(hist->n = count()))
+    return -1;
+  struct stat st;
+  if (fstat(hist->log, &st))
+    ERROR("fstat() failed");
+  if (hist->maplen < (size_t)st.st_size)
+  {
+    if (hist->map)
+      munmap(hist->map, hist->maplen);
+    hist->maplen = st.st_size;
+    hist->map = mmap(0, hist->maplen, PROT_READ, MAP_SHARED, hist->log, 0);
+    if (hist->map == MAP_FAILED)
+      ERROR("mmap() failed");
+  }
+  size_t ilen = sizeof(MAGIC) - 1 + hist->n * sizeof(uint64_t);
+  if (hist->imaplen < ilen)
+  {
+    if (hist->imap)
+      munmap(hist->imap, hist->imaplen);
+    hist->imaplen = ilen;
+    hist->imap = mmap(0, hist->imaplen, PROT_READ, MAP_SHARED, hist->idx, 0);
+    if (hist->imap == MAP_FAILED)
+      ERROR("mmap() failed");
+  }
+  // The log may already hold a line whose index entry is still to come
+  uint64_t last = ((uint64_t *)(hist->imap + sizeof(MAGIC) - 1))[hist->n - 1];
+  char *nl = last < hist->maplen ? memchr(hist->map + last, '\n', hist->maplen - last) : 0;
+  hist->end = nl ? (uint64_t)(nl - hist->map + 1) : hist->maplen;
+  return 0;
+}
+
+// Offset of entry i in the log (needs map())
+static uint64_t off(long i)
+{
+  return ((uint64_t *)(hist->imap + sizeof(MAGIC) - 1))[i];
+}
+
+// Length of entry i, without its newline (needs map()), found from the line itself
+static size_t len(long i)
+{
+  uint64_t at = off(i);
+  if (at >= hist->maplen)
+    return 0;
+  char *nl = memchr(hist->map + at, '\n', hist->maplen - at);
+  return (nl ? (uint64_t)(nl - hist->map) : hist->maplen) - at;
+}
+
+/**
+ * @brief Indexes the log from offset from up to its end
+ *
+ * Only lines added since the index was last written are scanned.
+ */
+static void indexTail(uint64_t from, uint64_t size)
+{
+  if (from >= size)
+    return;
+  char *m = mmap(0, size, PROT_READ, MAP_SHARED, hist->log, 0);
+  if (m == MAP_FAILED)
+    ERROR("mmap() failed");
+  size_t cap = 1024, k = 0;
+  uint64_t *offs = malloc(cap * sizeof(uint64_t));
+  if (!offs)
+    ERROR("malloc() failed");
+  for (uint64_t p = from; p < size;)
+  {
+    char *nl = memchr(m + p, '\n', size - p);
+    if (!nl)
+      break; // partial last line, left for later
+    if (k == cap)
+    {
+      cap *= 2;
+      offs = realloc(offs, cap * sizeof(uint64_t));
+      if (!offs)
+        ERROR("realloc() failed");
+    }
+    offs[k++] = p;
+    p = nl - m + 1;
+    hist->end = p;
+  }
+  munmap(m, size);
+  if (k && write(hist->idx, offs, k * sizeof(uint64_t)) != (ssize_t)(k * sizeof(uint64_t)))
+    ERROR("write() failed");
+  hist->n += k;
+  free(offs);
+}
+
+/**
+ * @brief Checks the index against the log, and brings it up to date
+ *
+ * The index is trusted if its last entry starts a line of the log; lines
+ * after that one are indexed. Anything else rebuilds the index.
+ */
+static void check()
+{
+  struct stat ls, is;
+  if (fstat(hist->log, &ls) || fstat(hist->idx, &is))
+    ERROR("fstat() failed");
+  char magic[sizeof(MAGIC) - 1];
+  long n = is.st_size >= (off_t)sizeof(magic) ? (is.st_size - sizeof(magic)) / sizeof(uint64_t) : -1;
+  uint64_t last = 0;
+  int ok = n >= 0 && pread(hist->idx, magic, sizeof(magic), 0) == sizeof(magic) &&
+           !memcmp(magic, MAGIC, sizeof(magic));
+  if (ok && n > 0)
+  {
+    char c = '\n';
+    ok = pread(hist->idx, &last, sizeof(last), sizeof(magic) + (n - 1) * sizeof(uint64_t)) == sizeof(last) &&
+         last < (uint64_t)ls.st_size &&
+         (!last || pread(hist->log, &c, 1, last - 1) == 1) && c == '\n';
+  }
+  if (!ok)
+  {
+    // Start the index over
+    if (ftruncate(hist->idx, 0) || pwrite(hist->idx, MAGIC, sizeof(magic), 0) != sizeof(magic))
+      ERROR("failed to reset history index");
+    n = 0;
+    last = 0;
+  }
+  if (n)
+    n--; // the last indexed line is scanned again to find its end
+  if (ftruncate(hist->idx, sizeof(magic) + n * sizeof(uint64_t)))
+    ERROR("ftruncate() failed");
+  hist->n = n;
+  hist->end = last;
+  indexTail(last, ls.st_size);
+  // Finish off a last line without a newline, so appends start a new one
+  if (hist->end < (uint64_t)ls.st_size)
+  {
+    if (write(hist->log, "\n", 1) != 1)
+      ERROR("write() failed");
+    indexTail(hist->end, ls.st_size + 1);
+  }
+}
+
+extern void openHistory(char *file)
+{
+  hist = calloc(1, sizeof(*hist));
+  if (!hist)
+    ERROR("calloc() failed");
+  if (file)
+  {
+    char *idx;
+    if (asprintf(&idx, "%s.idx", file) == -1)
+      ERROR("asprintf() failed");
+    hist->log = open(file, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    hist->idx = open(idx, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    free(idx);
+  }
+  else
+  {
+    hist->log = memfd_create("history", MFD_CLOEXEC);
+    hist->idx = memfd_create("history.idx", MFD_CLOEXEC);
+    // Appended to like the files, so check() and addHistory() needn't tell them apart
+    if (hist->log != -1 && hist->idx != -1 &&
+        (fcntl(hist->log, F_SETFL, O_APPEND) || fcntl(hist->idx, F_SETFL, O_APPEND)))
+      ERROR("fcntl() failed");
+  }
+  if (hist->log == -1 || hist->idx == -1)
+    ERROR("failed to open history");
+  flock(hist->idx, LOCK_EX);
+  check();
+  flock(hist->idx, LOCK_UN);
+
+  // Readline only needs the most recent entries
+  stifle_history(LOAD);
+  if (!map())
+    for (long i = hist->n > LOAD ? hist->n - LOAD : 0; i < hist->n; i++)
+    {
+      char *s = strndup(hist->map + off(i), len(i));
+      add_history(s);
+      free(s);
+    }
+}
+
+extern void addHistory(char *line)
+{
+  add_history(line);
+  if (!hist)
+    return;
+  size_t n = strlen(line);
+  struct iovec iov[2] = {{line, n}, {"\n", 1}};
+  // Other shells sharing the files append too: the line and its index entry go
+  // in under a lock, so the index stays in log order (searchHistory() relies on
+  // it), and the entries are counted from its size (see count())
+  flock(hist->idx, LOCK_EX);
+  if (writev(hist->log, iov, 2) == (ssize_t)n + 1)
+  {
+    uint64_t at = lseek(hist->log, 0, SEEK_CUR) - (n + 1);
+    // A failed write leaves the line unindexed, as a failed writev() leaves it out
+    (void)!write(hist->idx, &at, sizeof(at));
+  }
+  flock(hist->idx, LOCK_UN);
+}
+
+/**
+ * @brief Prints entries i up to (not including) j, numbered from 1
+ *
+ * Lines are copied straight out of the mapped log into one buffer per
+ * block of output, instead of one printf() per entry.
+ */
+static void print(FILE *f, long i, long j)
+{
+  char buf[1 << 16];
+  size_t k = 0;
+  for (; i < j; i++)
+  {
+    size_t n = len(i);
+    if (k + n + 32 > sizeof(buf))
+    {
+      fwrite(buf, 1, k, f);
+      k = 0;
+    }
+    k += sprintf(buf + k, "%ld: ", i + 1);
+    if (n + 32 > sizeof(buf))
+    {
+      fwrite(buf, 1, k, f);
+      fwrite(hist->map + off(i), 1, n, f);
+      fputc('\n', f);
+      k = 0;
+      continue;
+    }
+    memcpy(buf + k, hist->map + off(i), n);
+    k += n;
+    buf[k++] = '\n';
+  }
+  fwrite(buf, 1, k, f);
+}
+
+extern void printHistory(FILE *f, int last)
+{
+  if (map())
+    return;
+  print(f, last > 0 && last < hist->n ? hist->n - last : 0, hist->n);
+}
+
+extern void searchHistory(FILE *f, char *s)
+{
+  if (map() || !*s)
+    return;
+  size_t m = strlen(s);
+  for (uint64_t p = off(0); p < hist->end;)
+  {
+    char *hit = memmem(hist->map + p, hist->end - p, s, m);
+    if (!hit)
+      break;
+    // The entry holding the hit is the last one starting at or before it
+    uint64_t at = hit - hist->map;
+    long lo = 0, hi = hist->n - 1;
+    while (lo < hi)
+    {
+      long mid = (lo + hi + 1) / 2;
+      if (off(mid) <= at)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+    // A match across a newline isn't in any one entry
+    if (at + m <= off(lo) + len(lo))
+      print(f, lo, lo + 1);
+    p = lo + 1 < hist->n ? off(lo + 1) : hist->end;
+  }
+}
+
+extern long sizeHistory()
+{
+  return hist ? count() : 0;
+}
+
+extern void closeHistory()
+{
+  if (!hist)
+    return;
+  if (hist->map)
+    munmap(hist->map, hist->maplen);
+  if (hist->imap)
+    munmap(hist->imap, hist->imaplen);
+  close(hist->log);
+  close(hist->idx);
+  free(hist);
+  hist = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdio.h>
+
+/**
+ * Command history kept in an append-only log with a line-offset index
+ *
+ * The log is plain text, one command per line (the same format as the
+ * old readline .history file). Next to it, file.idx holds the starting
+ * offset of every line. Each command costs one append to each file, and
+ * both are mmap()ed when read, so neither startup nor exit has to read
+ * or rewrite the whole history: startup indexes only lines added by
+ * something else since the last run, and hands readline just the tail.
+ * Shells sharing the files append a line and its offset under a lock on
+ * the index (flock()), so the offsets stay in log order.
+ */
+
+/**
+ * @brief Opens (creating if needed) the history log and its index
+ *
+ * Loads the most recent entries into readline for line editing.
+ *
+ * @param file Log file name, or NULL to keep history in memory only
+ * @return VOID
+ */
+extern void openHistory(char *file);
+
+/**
+ * @brief Appends a command line to the history
+ * @param line Command line (without newline)
+ * @return VOID
+ */
+extern void addHistory(char *line);
+
+/**
+ * @brief Prints history entries, numbered from 1
+ * @param f Stream to print to
+ * @param last Print only the last this many entries, or all if <= 0
+ * @return VOID
+ */
+extern void printHistory(FILE *f, int last);
+
+/**
+ * @brief Prints the history entries that contain a string
+ * @param f Stream to print to
+ * @param s String to search for
+ * @return VOID
+ */
+extern void searchHistory(FILE *f, char *s);
+
+/**
+ * @brief Gets the number of entries in the history
+ * @return Number of entries
+ */
+extern long sizeHistory();
+
+/**
+ * @brief Unmaps and closes the history files
+ * @return VOID
+ */
+extern void closeHistory();
+
+#endif
@@ -12,13 +12,16 @@
  */
 static Command i_command(T_command t);
 static void i_pipeline(T_pipeline t, Pipeline pipeline);
-static void i_sequence(T_sequence t, Sequence sequence);
+static void i_sequence(T_sequence t, Sequence sequence, int last, char *op);
 
 /**
  * @brief Interprets a single command node from the parse tree
  *
  * The bottom level of the tree-walking interpreter. It extracts the words (command name and arguments) from a comand parse tree node and creates an executable Command object
  *
+ * A { } or ( ) group becomes a Command holding its own Sequence. A subshell only ever runs in a
+ * process of its own, so the last command in it can replace that process rather than fork again
+ *
  * @param t Command node from parse tree containing words and redirection info
  *
  * @return Command object ready to be added to a pipeline
@@ -29,8 +32,37 @@ static Command i_command(T_command t)
   if (!t)
     return 0;
   Command command = 0;
-  if (t->words)
+  if (t->group)
+  {
+    Sequence sequence = newSequence();
+    i_sequence(t->group, sequence, t->subshell, 0);
+    command = newGroup(sequence, t->redir, t->subshell);
+  }
+  else if (t->control)
+  {
+    // Built once: a loop runs these sequences again and again (see Control.h)
+    T_control c = t->control;
+    Sequence cond = 0, body = newSequence(), other = 0;
+    if (c->cond)
+      i_sequence(c->cond, cond = newSequence(), 0, 0);
+    i_sequence(c->body, body, 0, 0);
+    if (c->other)
+      i_sequence(c->other, other = newSequence(), 0, 0);
+    command = newCompound(newControl(c, cond, body, other), t->redir);
+  }
+  else if (t->words)
+  {
     command = newCommand(t->words, t->redir);
+    // <( ) and >( ) words: built once, run in a process of their own each time
+    int i = 0;
+    for (T_words w = t->words; w; w = w->words, i++)
+      if (w->word->subst)
+      {
+        Sequence sequence = newSequence();
+        i_sequence(w->word->subst, sequence, 1, 0);
+        substCommand(command, i, sequence);
+      }
+  }
   return command;
 }
 
@@ -49,6 +81,15 @@ static void i_pipeline(T_pipeline t, Pipeline pipeline)
   if (!t)
     return;
   addPipeline(pipeline, i_command(t->command));
+  if (t->copies)
+    copiesPipeline(pipeline, t->copies, t->spread);
+  // Each |& branch becomes its own Pipeline fed by this one
+  for (T_sequence s = t->tee; s; s = s->sequence)
+  {
+    Pipeline branch = newPipeline(1);
+    i_pipeline(s->pipeline, branch);
+    teePipeline(pipeline, branch);
+  }
   i_pipeline(t->pipeline, pipeline);
 }
 /**
@@ -61,6 +102,8 @@ static void i_pipeline(T_pipeline t, Pipeline pipeline)
  *
  * @param t Sequence node from parse tree (may be NULL)
  * @param sequence Sequence object being built; pipelines are added to this
+ * @param last Non-zero if nothing runs after this sequence
+ * @param op The && or || before t, which makes its pipeline conditional, or NULL
  *
  * @return void (modifies sequence parameter in-place)
  *
@@ -69,7 +112,7 @@ static void i_pipeline(T_pipeline t, Pipeline pipeline)
 
 // TODO Implement background flag (&)
 // TODO newPipleine has hard coded parameter of 1 needs to be changed to actual foreground/background flag from parse tree
-static void i_sequence(T_sequence t, Sequence sequence)
+static void i_sequence(T_sequence t, Sequence sequence, int last, char *op)
 {
   if (!t)
   {
@@ -95,8 +138,17 @@ static void i_sequence(T_sequence t, Sequence sequence)
   i_pipeline(t->pipeline, pipeline);
   // printf("DEBUG ^^^^^^^^ Return from i_pipeline ^^^^^^^^\n");
 
+  if (t->pipeline->timeout)
+    timeoutPipeline(pipeline, t->pipeline->timeout);
+  // The final pipeline of the last line may replace the shell
+  if (last && !t->sequence)
+    lastPipeline(pipeline);
+  // a && b runs b only on success, a || b only on failure
+  if (op)
+    condPipeline(pipeline, !strcmp(op, "&&") ? 1 : -1);
+
   addSequence(sequence, pipeline);
-  i_sequence(t->sequence, sequence);
+  i_sequence(t->sequence, sequence, last, t->op && (!strcmp(t->op, "&&") || !strcmp(t->op, "||")) ? t->op : 0);
 }
 
 /**
@@ -123,8 +175,9 @@ static void i_sequence(T_sequence t, Sequence sequence)
  * @param t Parse tree root representing complete user input (may be NULL)
  * @param eof Pointer to EOF flag; execSequence may set this to signal exit
  * @param jobs Job table for tracking all running/suspended processes
+ * @param last Non-zero if nothing runs after this tree
  *
- * @return void
+ * @return Exit status of the last pipeline run, 0 for an empty tree
  *
  * @note If t is NULL (empty input or parse error), function returns immediately
  * @note All actual execution happens in execSequence() - this function only
@@ -132,16 +185,16 @@ static void i_sequence(T_sequence t, Sequence sequence)
  * @note Memory management: Sequence and contained objects should be freed
  *       after execution (currently this may be missing - check for leaks!)
  */
-extern void interpretTree(Tree t, int *eof, Jobs jobs)
+extern int interpretTree(Tree t, int *eof, Jobs jobs, int last)
 {
   // Validate parse tree is valid
   if (!t)
   {
-    return;
+    return 0;
   }
   // New sequence created
   // A sequence is the root of the grammer the highest level rule
   Sequence sequence = newSequence();
-  i_sequence(t, sequence);
-  execSequence(sequence, jobs, eof);
+  i_sequence(t, sequence, last, 0);
+  return execSequence(sequence, jobs, eof);
 }
@@ -18,9 +18,11 @@
  * @param t Parse tree representing the complete command(s) entered by user
  * @param eof Pointer to EOF flag; set to non-zero if user wants to exit shell
  * @param jobs Job table for tracking background and foreground processes
+ * @param last Non-zero if nothing runs after this tree (last line of a script or -c),
+ *             so its final command can replace the shell instead of forking
  *
- * @return void
+ * @return Exit status of the last pipeline run
  */
-extern void interpretTree(Tree t, int *eof, Jobs jobs);
+extern int interpretTree(Tree t, int *eof, Jobs jobs, int last);
 
 #endif
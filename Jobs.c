@@ -14,6 +14,46 @@ extern int sizeJobs(Jobs jobs) {
   return deq_len(jobs);
 }
 
+// Brings background job n (from 1, in the order started) or, for 0, the
+// latest one still running to the foreground; -1 if there is no such job
+extern int fgJobs(Jobs jobs, int n) {
+  if (n) {
+    for (int i = 0; i < deq_len(jobs); i++) {
+      Pipeline p = deq_head_ith(jobs, i);
+      if (bgPipeline(p) && !--n)
+        return fgPipeline(p);
+    }
+    return -1;
+  }
+  for (int i = 0; i < deq_len(jobs); i++) {
+    int status = fgPipeline(deq_tail_ith(jobs, i));
+    if (status >= 0)
+      return status;
+  }
+  return -1;
+}
+
+// Shows the output captured so far of background job n (from 1, as for
+// fgJobs); -1 if there is no such job or its output isn't captured
+extern int outputJobs(Jobs jobs, int n) {
+  for (int i = 0; i < deq_len(jobs); i++) {
+    Pipeline p = deq_head_ith(jobs, i);
+    if (bgPipeline(p) && !--n)
+      return outputPipeline(p);
+  }
+  return -1;
+}
+
+// Lists the background jobs, numbered as for fgJobs, on stdout
+extern void listJobs(Jobs jobs) {
+  int n = 0;
+  for (int i = 0; i < deq_len(jobs); i++) {
+    Pipeline p = deq_head_ith(jobs, i);
+    if (bgPipeline(p))
+      printPipeline(p, ++n);
+  }
+}
+
 extern void freeJobs(Jobs jobs) {
   deq_del(jobs,freePipeline);
 }
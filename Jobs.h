@@ -8,6 +8,9 @@ typedef void *Jobs;
 extern Jobs newJobs();
 extern void addJobs(Jobs jobs, Pipeline pipeline);
 extern int sizeJobs(Jobs jobs);
+extern int fgJobs(Jobs jobs, int n);
+extern int outputJobs(Jobs jobs, int n);
+extern void listJobs(Jobs jobs);
 extern void freeJobs(Jobs jobs);
 
 #endif
@@ -0,0 +1,316 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // F_GETPIPE_SZ
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#include "Meter.h"
+#include "error.h"
+
+// Milliseconds between samples
+#define TICK 50
+// Milliseconds between redraws of the live line
+#define LIVE 1000
+
+// What a stage was doing when sampled
+enum
+{
+  RUN,
+  READ,
+  WRITE,
+  OTHER,
+  STATES
+};
+static char *states[] = {"run", "read", "write", "other"};
+static char marks[] = "R<>S";
+
+// Where in the kernel a stage waits (wchan) for input, and for output
+static char *reading[] = {"pipe_read", "pipe_wait_readable", "ipipe", "poll", "select", 0};
+static char *writing[] = {"pipe_write", "pipe_wait_writable", "opipe", 0};
+
+typedef struct
+{
+  int pid;
+  char name[16];
+  int done;                 // gone (or a zombie) when last sampled
+  int state;                // at the last sample
+  long ticks[STATES];       // samples in each state
+  unsigned long long wchar; // bytes written, at the last sample
+  unsigned long long shown; // bytes written, at the last live line
+  double seen;              // seconds from the start to the last sample
+  long fill;                // sum of the output pipe's fill, in percent
+  long fills;               // samples of it, 0 if the output isn't a pipe
+} Stage;
+
+// A pipeline being metered. Its stages are written by the sampling thread
+// only, and read by the shell once it has joined it. The thread doesn't
+// malloc(), and write()s the live line itself rather than through stderr
+typedef struct
+{
+  Stage *stages;
+  int n;
+  pthread_t worker;
+  int wake; // eventfd: the pipeline has ended
+  int tty;  // stderr is a terminal, for the live line
+  int live; // a live line is showing
+  struct timespec start;
+} *MeterRep;
+
+static int on = 0;
+
+extern int setMeter(char *mode)
+{
+  if (!strcmp(mode, "on"))
+    on = 1;
+  else if (!strcmp(mode, "off"))
+    on = 0;
+  else
+    return -1;
+  return 0;
+}
+
+extern void printMeter(FILE *f)
+{
+  fprintf(f, "%s\n", on ? "on" : "off");
+}
+
+extern int onMeter()
+{
+  return on;
+}
+
+static double elapsed(MeterRep m)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (t.tv_sec - m->start.tv_sec) + (t.tv_nsec - m->start.tv_nsec) / 1e9;
+}
+
+// Reads a small file whole, as a string
+static ssize_t slurp(char *path, char *buf, size_t size)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+  ssize_t m = read(fd, buf, size - 1);
+  close(fd);
+  buf[m > 0 ? m : 0] = 0;
+  return m;
+}
+
+static int any(char *s, char **words)
+{
+  for (; *words; words++)
+    if (strstr(s, *words))
+      return 1;
+  return 0;
+}
+
+/**
+ * @brief Samples a stage: its state, bytes written, and its output pipe
+ */
+static void sample(Stage *s, double t)
+{
+  char path[64], buf[512];
+  snprintf(path, sizeof(path), "/proc/%d/stat", s->pid);
+  char *lp = 0, *rp = 0;
+  if (slurp(path, buf, sizeof(buf)) > 0)
+  {
+    lp = strchr(buf, '(');
+    rp = strrchr(buf, ')');
+  }
+  if (!lp || !rp || rp < lp || rp[1] != ' ' || rp[2] == 'Z' || rp[2] == 'X')
+  {
+    s->done = 1;
+    return;
+  }
+  size_t len = rp - lp - 1 < sizeof(s->name) - 1 ? rp - lp - 1 : sizeof(s->name) - 1;
+  memcpy(s->name, lp + 1, len);
+  s->name[len] = 0;
+
+  int state = RUN;
+  if (rp[2] != 'R')
+  {
+    char wchan[64];
+    snprintf(path, sizeof(path), "/proc/%d/wchan", s->pid);
+    if (slurp(path, wchan, sizeof(wchan)) < 0)
+      wchan[0] = 0;
+    state = any(wchan, reading) ? READ : any(wchan, writing) ? WRITE : OTHER;
+  }
+  s->state = state;
+  s->ticks[state]++;
+  s->seen = t;
+
+  snprintf(path, sizeof(path), "/proc/%d/io", s->pid);
+  char *w;
+  if (slurp(path, buf, sizeof(buf)) > 0 && (w = strstr(buf, "wchar: ")))
+    s->wchar = strtoull(w + 7, 0, 10);
+
+  // Opening the pipe for reading a moment doesn't take anything out of it
+  struct stat st;
+  snprintf(path, sizeof(path), "/proc/%d/fd/1", s->pid);
+  if (stat(path, &st) || !S_ISFIFO(st.st_mode))
+    return;
+  int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1)
+    return;
+  int q = 0, cap = fcntl(fd, F_GETPIPE_SZ);
+  if (cap > 0 && !ioctl(fd, FIONREAD, &q))
+  {
+    s->fill += 100L * q / cap;
+    s->fills++;
+  }
+  close(fd);
+}
+
+// Bytes per second, as 12.3MB/s
+static void rate(char *buf, size_t size, double bps)
+{
+  char *units[] = {"B", "KB", "MB", "GB", 0};
+  int u = 0;
+  while (bps >= 1000 && units[u + 1])
+  {
+    bps /= 1000;
+    u++;
+  }
+  snprintf(buf, size, "%.1f%s/s", bps, units[u]);
+}
+
+/**
+ * @brief Redraws the live line: each stage's rate over the last LIVE, and what it is doing
+ */
+static void draw(MeterRep m, double t)
+{
+  char line[1024], r[32];
+  size_t len = snprintf(line, sizeof(line), "\r\033[Kmeter %.0fs:", t);
+  for (int i = 0; i < m->n && len < sizeof(line); i++)
+  {
+    Stage *s = &m->stages[i];
+    rate(r, sizeof(r), (s->wchar - s->shown) * 1000.0 / LIVE);
+    s->shown = s->wchar;
+    len += snprintf(line + len, sizeof(line) - len, "%s %s %s %c", i ? " |" : "", s->name, r,
+                    s->done ? '-' : marks[s->state]);
+  }
+  if (len > sizeof(line))
+    len = sizeof(line);
+  if (write(STDERR_FILENO, line, len) > 0)
+    m->live = 1;
+}
+
+static void *work(void *arg)
+{
+  MeterRep m = arg;
+  long next = LIVE;
+  struct pollfd p = {m->wake, POLLIN, 0};
+  while (poll(&p, 1, TICK) == 0)
+  {
+    double t = elapsed(m);
+    for (int i = 0; i < m->n; i++)
+      if (!m->stages[i].done)
+        sample(&m->stages[i], t);
+    if (m->tty && t * 1000 >= next)
+    {
+      draw(m, t);
+      next += LIVE;
+    }
+  }
+  return 0;
+}
+
+extern Meter startMeter(int *pids, int count)
+{
+  MeterRep m = calloc(1, sizeof(*m));
+  if (!m || !(m->stages = calloc(count, sizeof(Stage))))
+    ERROR("calloc() failed");
+  m->n = count;
+  for (int i = 0; i < m->n; i++)
+  {
+    m->stages[i].pid = pids[i];
+    snprintf(m->stages[i].name, sizeof(m->stages[i].name), "?");
+  }
+  m->tty = isatty(STDERR_FILENO);
+  clock_gettime(CLOCK_MONOTONIC, &m->start);
+
+  // Signals are for the shell's own thread
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  m->wake = eventfd(0, EFD_CLOEXEC);
+  if (m->wake == -1 || pthread_create(&m->worker, 0, work, m))
+    ERROR("can't start the meter");
+  pthread_sigmask(SIG_SETMASK, &old, 0);
+  return m;
+}
+
+extern void endMeter(Meter meter)
+{
+  MeterRep m = meter;
+  if (!m)
+    return;
+  uint64_t one = 1;
+  if (write(m->wake, &one, sizeof(one)) != sizeof(one))
+    ERROR("can't stop the meter");
+  pthread_join(m->worker, 0);
+  close(m->wake);
+  double t = elapsed(m);
+  if (m->live)
+    fputs("\r\033[K", stderr);
+  Stage *stages = m->stages;
+  int n = m->n;
+  long samples = 0;
+  for (int i = 0; i < n; i++)
+  {
+    long k = 0;
+    for (int j = 0; j < STATES; j++)
+      k += stages[i].ticks[j];
+    if (k > samples)
+      samples = k;
+  }
+  if (!samples)
+    fprintf(stderr, "meter: %.2fs, too short to sample\n", t);
+  else
+  {
+    fprintf(stderr, "meter: %.2fs, %ld samples\n", t, samples);
+    int worst = -1;
+    long most = -1;
+    for (int i = 0; i < n; i++)
+    {
+      Stage *s = &stages[i];
+      long k = 0;
+      for (int j = 0; j < STATES; j++)
+        k += s->ticks[j];
+      char r[32], fill[8];
+      rate(r, sizeof(r), s->seen > 0 ? s->wchar / s->seen : 0);
+      if (s->fills)
+        snprintf(fill, sizeof(fill), "%ld%%", s->fill / s->fills);
+      else
+        snprintf(fill, sizeof(fill), "-");
+      fprintf(stderr, "  %d %-15s %12s out %5s full", i + 1, s->name, r, fill);
+      for (int j = 0; j < STATES; j++)
+        fprintf(stderr, "  %s %3ld%%", states[j], k ? s->ticks[j] * 100 / k : 0);
+      fputc('\n', stderr);
+      long busy = k ? (s->ticks[RUN] + s->ticks[OTHER]) * 100 / k : -1;
+      if (busy > most)
+      {
+        most = busy;
+        worst = i;
+      }
+    }
+    fprintf(stderr, "meter: bottleneck stage %d (%s), busy %ld%% of its samples\n", worst + 1,
+            stages[worst].name, most);
+  }
+  fflush(stderr);
+  free(stages);
+  free(m);
+}
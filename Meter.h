@@ -0,0 +1,73 @@
+#ifndef METER_H
+#define METER_H
+
+#include <stdio.h>
+
+typedef void *Meter;
+
+/**
+ * Throughput metering of foreground pipelines
+ *
+ *   meter [on | off]   sets (or shows) whether pipelines are metered
+ *
+ * Off by default. When on, a thread of the shell samples the stages of
+ * each foreground pipeline of two or more stages every 50ms while the
+ * shell waits for them, from outside the data path: it never touches
+ * the data, and the shell keeps no pipe open. For each stage it reads
+ *
+ *   /proc/PID/stat, wchan   running, or asleep reading a pipe (or in
+ *                           poll()), writing one, or on something else
+ *                           (a file, a terminal, a timer)
+ *   /proc/PID/io            bytes written so far (wchar)
+ *   /proc/PID/fd/1          its output pipe, reopened for a moment to
+ *                           read how full it is (FIONREAD)
+ *
+ * When the pipeline ends a summary goes to stderr, a line per stage:
+ * its output rate, how full its output pipe was on average, and how
+ * the samples split between running, blocked on read, blocked on write
+ * and other. The stage that was busy (running or on something else) in
+ * the most samples is named as the bottleneck: the stages before it
+ * wait to write to it, and the ones after it wait to read from it.
+ *
+ * On a terminal, a pipeline still running after a second also gets a
+ * live line on stderr, redrawn every second, with each stage's rate
+ * over the last second and what it is doing: R running, < reading,
+ * > writing, S other.
+ */
+
+/**
+ * @brief Turns metering on or off
+ * @param mode "on" or "off"
+ * @return 0, or -1 if mode isn't one of those
+ */
+extern int setMeter(char *mode);
+
+/**
+ * @brief Prints whether metering is on, as meter takes it
+ * @param f Stream to print to
+ * @return VOID
+ */
+extern void printMeter(FILE *f);
+
+/**
+ * @brief Whether metering is on
+ * @return Non-zero if so
+ */
+extern int onMeter();
+
+/**
+ * @brief Starts sampling the stages of a foreground pipeline
+ * @param pids Stages, in the order forked (copied)
+ * @param n Number of stages
+ * @return The pipeline's meter
+ */
+extern Meter startMeter(int *pids, int n);
+
+/**
+ * @brief Stops sampling and writes the summary to stderr
+ * @param meter Meter from startMeter(), or NULL for none
+ * @return VOID
+ */
+extern void endMeter(Meter meter);
+
+#endif
@@ -5,12 +5,19 @@
 #include "Parser.h"
 #include "Tree.h"
 #include "Scanner.h"
+#include "Stats.h"
+#include "Deadline.h"
+#include "Results.h"
+#include "Replica.h"
+#define ALLOC_MODULE AL_PARSER
+#include "Alloc.h"
 #include "error.h"
 
-static Scanner scan;
+// Scanner of the line being parsed, 0 between lines
+static Scanner scan = 0;
 
 #undef ERROR
-#define ERROR(s) ERRORLOC(__FILE__, __LINE__, "error", "%s (pos: %d)", s, posScanner(scan))
+#define ERROR(s) ERRORLOC(__FILE__, __LINE__, "error", "%s (pos: %d)", s, scan ? posScanner(scan) : 0)
 
 // Scanner Integreation
 // Utilizes Scanner functionality to tokenize input command string
@@ -24,9 +31,58 @@ static int eat(char *s) { return eatScanner(scan, s); } // Compares a given stri
 static T_word p_word();   // Parses word
 static T_words p_words(); // Parses words
 static T_redir p_redir();
+static T_control p_control();   // Parses if, while and for
 static T_command p_command();   // Parses commands
 static T_pipeline p_pipeline(); // Parses pipeline
 static T_sequence p_sequence(); // Parses sequence
+static T_word p_subst();        // Parses <( sequence ) and >( sequence )
+
+/**
+ * @brief Checks if the current token starts with the given operator
+ *
+ * The scanner only splits on whitespace so an operator may be glued to its operand (<<EOF)
+ *
+ * @param op Operator to look for
+ * @return 1 if the current token begins with op, 0 if not
+ */
+static int pre(char *op)
+{
+  char *s = curr();
+  return s && !strncmp(s, op, strlen(op));
+}
+
+/**
+ * @brief Checks if the current token is an operator that ends a list of words
+ * @return 1 if the current token is an operator, 0 if not
+ */
+static int isop()
+{
+  return cmp("|") || cmp("&") || cmp(";") || cmp("<") || cmp(">") || pre("<<") ||
+         pre("<&") || pre(">&") ||
+         cmp("|&") || cmp("}") || cmp(")") || cmp("&&") || cmp("||") || pre("|[");
+}
+
+// Keywords that end the sequence before them, where a command would start
+static char *closers[] = {"then", "elif", "else", "fi", "do", "done", 0};
+
+/**
+ * @brief Checks if the current token is a keyword that ends a sequence (then, fi, done...)
+ * @return 1 if it is, 0 if not
+ */
+static int closer()
+{
+  for (char **k = closers; *k; k++)
+    if (cmp(*k))
+      return 1;
+  return 0;
+}
+
+// Skips the ; allowed after then, do and else (where a joined line put one)
+static void semis()
+{
+  while (eat(";"))
+    ;
+}
 
 /**
  * @brief Parses a single word token from the input stream
@@ -45,13 +101,32 @@ static T_word p_word()
   T_word word = new_word();
 
   // Set T_word node to be the token
-  word->s = strdup(s);
+  word->s = dupAlloc(AL_PARSER, s, strlen(s));
 
   // Advance scanner
   next();
   return word;
 }
 
+/**
+ * @brief Parses a process substitution, <( sequence ) or >( sequence ), as a word
+ *
+ * The word is replaced by a /dev/fd/N path to a pipe from (or to) the
+ * sequence each time the command runs (see Command.h)
+ *
+ * @return T_word node, with the sequence in subst
+ */
+static T_word p_subst()
+{
+  T_word word = p_word();
+  word->subst = p_sequence();
+  if (!word->subst)
+    ERROR("expected pipeline after <( or >(");
+  if (!eat(")"))
+    ERROR("expected ) to end <( or >(");
+  return word;
+}
+
 /**
  * @brief Parses multiple words
  *  Recusively parses multiple words until a shell operator is encountered. Creates a linked list of T_words nodes where each node contains one word and optionally points to the next words in the sequence
@@ -60,7 +135,7 @@ static T_word p_word()
 static T_words p_words()
 {
   // Get first word
-  T_word word = p_word();
+  T_word word = cmp("<(") || cmp(">(") ? p_subst() : p_word();
   // If word NULL return ERROR
   if (!word)
     return 0;
@@ -72,7 +147,7 @@ static T_words p_words()
 
   // If any operators encountered return words
   // Grammar states that words can only be word or words word
-  if (cmp("|") || cmp("&") || cmp(";") || cmp("<") || cmp(">"))
+  if (isop())
     return words;
 
   // Recursively parse more words
@@ -86,22 +161,39 @@ static T_words p_words()
  *
  * A command is composed of one or more words with a possible redir (<,>). Creates a T_command node that wraps the parsed words
  *
- * MORE INFO grammar says that a command can contain a redir but Tree.[hc] does not support functionality for that
+ * Instead of words a command may be a group: { sequence } runs in the shell, ( sequence ) in a subshell.
+ * Either way the redir applies to the whole group
  *
  * @return T_command node containing the parsed command
  */
 static T_command p_command()
 {
-  // Instantziate words
-  T_words words = 0;
-  // Set words node to be result of parsing words
-  words = p_words();
-  if (!words)
+  // A closing } or ) ends the enclosing group, it is not a command, nor is fi, done...
+  if (isop() || closer())
     return 0;
   // Create T_command node
   T_command command = new_command();
-  // Set T_command words attribute to be the parsed words
-  command->words = words;
+  if (cmp("if") || cmp("while") || cmp("for"))
+    command->control = p_control();
+  else if (eat("{") || (command->subshell = eat("(")))
+  {
+    char *close = command->subshell ? ")" : "}";
+    command->group = p_sequence();
+    if (!command->group)
+      ERROR("expected pipeline in group");
+    if (!eat(close))
+      ERROR(command->subshell ? "expected ) to end (" : "expected } to end {");
+  }
+  else
+  {
+    // Set T_command words attribute to be the parsed words
+    command->words = p_words();
+    if (!command->words)
+    {
+      del_command(command);
+      return 0;
+    }
+  }
   command->redir = p_redir();
   return command;
 }
@@ -111,6 +203,10 @@ static T_command p_command()
  *
  * Handles commands connected via pipes for I/O. Recursively parses multiple piped commands creating a linked list structure where each pipeline node contains a command and may point to the next pipeline segment
  *
+ * The last command may fan out with |& { a ; b }: its output is copied to every pipeline in the braces
+ *
+ * A command after |[N] instead of | is run as N copies sharing its input and output (see Replica.h)
+ *
  * @return T_pipeline linked list of piped commands
  */
 static T_pipeline p_pipeline()
@@ -122,15 +218,144 @@ static T_pipeline p_pipeline()
   pipeline->command = command;
   if (eat("|"))
     pipeline->pipeline = p_pipeline();
+  else if (pre("|["))
+  {
+    // A bad one is taken as |
+    int copies = 0, spread = 0;
+    if (parseReplica(curr(), &copies, &spread))
+      ERROR("expected |[N] with flags o and r");
+    next();
+    pipeline->pipeline = p_pipeline();
+    if (!pipeline->pipeline)
+      ERROR("expected command after |[N]");
+    pipeline->pipeline->copies = copies;
+    pipeline->pipeline->spread = spread;
+  }
+  else if (eat("|&"))
+  {
+    // Fan-out: |& { pipeline ; pipeline ... }
+    if (!eat("{"))
+      ERROR("expected { after |&");
+    pipeline->tee = p_sequence();
+    if (!pipeline->tee)
+      ERROR("expected pipeline after |& {");
+    if (!eat("}"))
+      ERROR("expected } to end |& {");
+  }
   return pipeline;
 }
 
+static void f_words(T_words t);
+
+/**
+ * @brief Parses the rest of an if, after the if (or elif)
+ *
+ * An elif becomes an if alone in the else part, which the one fi ends.
+ */
+static T_control p_if()
+{
+  T_control t = new_control();
+  t->kind = "if";
+  t->cond = p_sequence();
+  if (!t->cond)
+    ERROR("expected pipeline after if");
+  if (!eat("then"))
+    ERROR("expected then after if");
+  semis();
+  t->body = p_sequence();
+  if (!t->body)
+    ERROR("expected pipeline after then");
+  if (eat("elif"))
+  {
+    t->other = new_sequence();
+    t->other->pipeline = new_pipeline();
+    t->other->pipeline->command = new_command();
+    t->other->pipeline->command->control = p_if();
+    return t;
+  }
+  if (eat("else"))
+  {
+    semis();
+    t->other = p_sequence();
+    if (!t->other)
+      ERROR("expected pipeline after else");
+  }
+  if (!eat("fi"))
+    ERROR("expected fi to end if");
+  return t;
+}
+
+/**
+ * @brief Parses a compound command: if, while or for
+ *
+ * Only the tree is built here. The interpreter turns it into a plan that
+ * is run as many times as the loop goes round, without parsing again.
+ *
+ * @return T_control node
+ */
+static T_control p_control()
+{
+  if (eat("if"))
+    return p_if();
+  T_control t = new_control();
+  if (eat("while"))
+  {
+    t->kind = "while";
+    t->cond = p_sequence();
+    if (!t->cond)
+      ERROR("expected pipeline after while");
+  }
+  else
+  {
+    eat("for");
+    t->kind = "for";
+    if (isop() || closer() || !(t->name = p_word()))
+      ERROR("expected name after for");
+    if (!eat("in"))
+      ERROR("expected in after for NAME");
+    if (!isop() && !closer())
+      t->words = p_words();
+    semis();
+  }
+  if (!eat("do"))
+    ERROR(t->cond ? "expected do after while" : "expected do after for");
+  semis();
+  t->body = p_sequence();
+  if (!t->body)
+    ERROR("expected pipeline after do");
+  if (!eat("done"))
+    ERROR("expected done to end loop");
+  return t;
+}
+
+/**
+ * @brief Takes a timeout DURATION prefix off the first command of a pipeline
+ *
+ * The deadline is for the whole pipeline, not just the command it is
+ * written before. timeout with nothing after the duration is left as it
+ * is: that is the builtin setting the default deadline.
+ */
+static void timed(T_pipeline t)
+{
+  T_words w = t->command->words;
+  if (!w || strcmp(w->word->s, "timeout") || !w->words || !w->words->words)
+    return;
+  long ms = parseDeadline(w->words->word->s);
+  if (ms < 0)
+    return;
+  t->command->words = w->words->words;
+  w->words->words = 0;
+  f_words(w);
+  t->timeout = ms;
+}
+
 /**
  * @brief Parses a sequence of pipelines connected by control operators
  *
  * Top-level parsing function that handles command sequences with:
  * - & operator: run pipeline in background and continue
  * - ; operator: run pipeline and wait for completion before continuing
+ * - && and || operators: run the next pipeline only if this one succeeded (&&) or failed (||)
  * Creates the root of the parse tree structure.
  *
  * @return root node of the parse tree
@@ -140,6 +365,7 @@ static T_sequence p_sequence()
   T_pipeline pipeline = p_pipeline();
   if (!pipeline)
     return 0;
+  timed(pipeline);
   T_sequence sequence = new_sequence();
   sequence->pipeline = pipeline;
   if (eat("&"))
@@ -152,6 +378,14 @@ static T_sequence p_sequence()
     sequence->op = ";";
     sequence->sequence = p_sequence();
   }
+  if (cmp("&&") || cmp("||"))
+  {
+    sequence->op = cmp("&&") ? "&&" : "||";
+    next();
+    sequence->sequence = p_sequence();
+    if (!sequence->sequence)
+      ERROR("expected pipeline after && or ||");
+  }
   return sequence;
 }
 
@@ -165,18 +399,26 @@ static T_sequence p_sequence()
  */
 extern Tree parseTree(char *s)
 {
+  long start = nowStats();
+  lineStats(start);
+  lineAlloc(s);
+  lineResults();
   scan = newScanner(s);
 
   Tree tree = p_sequence();
   if (curr())
     ERROR("extra characters at end of input");
   freeScanner(scan);
+  scan = 0;
+  countStats(ST_LINES);
+  timeStats(ST_PARSE, start);
   return tree;
 }
 
 // Memory Managment
 static void f_word(T_word t);
 static void f_words(T_words t);
+static void f_control(T_control t);
 static void f_command(T_command t);
 static void f_pipeline(T_pipeline t);
 static void f_sequence(T_sequence t);
@@ -189,15 +431,19 @@ static void f_redir(T_redir t)
     free(t->input); // Free input filename
   if (t->output)
     free(t->output); // Free output filename
-  free(t);
+  if (t->delim)
+    free(t->delim); // Free here-document delimiter
+  if (t->here)
+    free(t->here); // Free here-document body
+  del_redir(t);
 }
 static void f_word(T_word t)
 {
   if (!t)
     return;
-  if (t->s)
-    free(t->s);
-  free(t);
+  freedupAlloc(t->s); // or 0, taken by the command
+  f_sequence(t->subst);
+  del_word(t);
 }
 
 static void f_words(T_words t)
@@ -206,7 +452,19 @@ static void f_words(T_words t)
     return;
   f_word(t->word);
   f_words(t->words);
-  free(t);
+  del_words(t);
+}
+
+static void f_control(T_control t)
+{
+  if (!t)
+    return;
+  f_sequence(t->cond);
+  f_sequence(t->body);
+  f_sequence(t->other);
+  f_word(t->name);
+  f_words(t->words);
+  del_control(t);
 }
 
 static void f_command(T_command t)
@@ -214,8 +472,10 @@ static void f_command(T_command t)
   if (!t)
     return;
   f_words(t->words);
+  f_sequence(t->group);
+  f_control(t->control);
   f_redir(t->redir);
-  free(t);
+  del_command(t);
 }
 
 static void f_pipeline(T_pipeline t)
@@ -224,7 +484,8 @@ static void f_pipeline(T_pipeline t)
     return;
   f_command(t->command);
   f_pipeline(t->pipeline);
-  free(t);
+  f_sequence(t->tee);
+  del_pipeline(t);
 }
 
 static void f_sequence(T_sequence t)
@@ -233,7 +494,7 @@ static void f_sequence(T_sequence t)
     return;
   f_pipeline(t->pipeline);
   f_sequence(t->sequence);
-  free(t);
+  del_sequence(t);
 }
 
 extern void freeTree(Tree t)
@@ -241,33 +502,218 @@ extern void freeTree(Tree t)
   f_sequence(t);
 }
 
+extern void *swapParser(void *state)
+{
+  Scanner old = scan;
+  scan = state;
+  return old;
+}
+
+/**
+ * @brief Parses the descriptor of a <&N or >&N, glued to the operator or the next token
+ * @return Descriptor, as written (expanded when the command runs), or NULL
+ */
+static char *p_dup()
+{
+  char *s = curr() + 2;
+  if (!*s)
+  {
+    next();
+    s = curr();
+    if (!s || isop() || closer())
+    {
+      ERROR("expected descriptor after <& or >&");
+      return NULL;
+    }
+  }
+  s = strdup(s);
+  next();
+  return s;
+}
+
 static T_redir p_redir()
 {
   T_redir redir = new_redir();
   redir->input = NULL;
   redir->output = NULL;
 
+  // Parse <<< word (here-string) and << word (here-document)
+  // The operand may be glued to the operator, so take the rest of the token if there is one
+  if (pre("<<"))
+  {
+    int string = pre("<<<");
+    char *s = curr() + (string ? 3 : 2);
+    if (*s)
+      s = strdup(s);
+    else
+    {
+      next();
+      s = curr() ? strdup(curr()) : 0;
+      if (!s)
+        ERROR(string ? "expected word after <<<" : "expected delimiter after <<");
+    }
+    next();
+    if (s && string)
+    {
+      // A here-string is the word followed by a newline
+      redir->here = malloc(strlen(s) + 2);
+      if (!redir->here)
+        ERROR("malloc() failed");
+      strcpy(redir->here, s);
+      strcat(redir->here, "\n");
+      free(s);
+    }
+    else
+      redir->delim = s; // body is read by hereTree() once the line is parsed
+  }
+  // Parse <&N (input from a descriptor)
+  else if (pre("<&"))
+  {
+    redir->input = p_dup();
+    redir->dupin = 1;
+  }
   // Parse < word (input redirection)
-  if (eat("<"))
+  else if (eat("<"))
   {
     T_word word = p_word();
     if (!word)
       ERROR("expected filename after <");
     redir->input = strdup(word->s); // Save filename
-    free(word->s);
-    free(word);
+    freedupAlloc(word->s);
+    del_word(word);
   }
 
+  // Parse >&N (output to a descriptor)
+  if (pre(">&"))
+  {
+    redir->output = p_dup();
+    redir->dupout = 1;
+  }
   // Parse > word (output redirection)
-  if (eat(">"))
+  else if (eat(">"))
   {
     T_word word = p_word();
     if (!word)
       ERROR("expected filename after >");
     redir->output = strdup(word->s); // Save filename
-    free(word->s);
-    free(word);
+    freedupAlloc(word->s);
+    del_word(word);
   }
 
   return redir;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Reads the body of one here-document
+ *
+ * Collects lines up to (not including) the delimiter line, each terminated by a newline
+ *
+ * @param t Redirection node with a pending delimiter
+ * @param line Line reader such as readline()
+ */
+static void h_redir(T_redir t, char *(*line)(const char *))
+{
+  if (!t || !t->delim || t->here)
+    return;
+  size_t len = 0, size = 128;
+  char *body = malloc(size);
+  if (!body)
+    ERROR("malloc() failed");
+  *body = 0;
+  char *s;
+  while ((s = line("> ")) && strcmp(s, t->delim))
+  {
+    size_t n = strlen(s);
+    if (len + n + 2 > size)
+    {
+      while (len + n + 2 > size)
+        size *= 2;
+      body = realloc(body, size);
+      if (!body)
+        ERROR("realloc() failed");
+    }
+    memcpy(body + len, s, n);
+    len += n;
+    body[len++] = '\n';
+    body[len] = 0;
+    free(s);
+  }
+  if (s)
+    free(s);
+  t->here = body;
+}
+
+static void h_sequence(T_sequence t, char *(*line)(const char *))
+{
+  for (; t; t = t->sequence)
+    for (T_pipeline p = t->pipeline; p; p = p->pipeline)
+    {
+      if (p->command)
+      {
+        h_sequence(p->command->group, line);
+        if (p->command->control)
+        {
+          h_sequence(p->command->control->cond, line);
+          h_sequence(p->command->control->body, line);
+          h_sequence(p->command->control->other, line);
+        }
+        h_redir(p->command->redir, line);
+      }
+      h_sequence(p->tee, line);
+    }
+}
+
+extern void hereTree(Tree t, char *(*line)(const char *))
+{
+  h_sequence(t, line);
+}
+
+// Words after which a command starts
+static char *starts[] = {";", "&", "&&", "||", "|", "|&", "{", "(", "then", "elif", "else", "do", "if", "while", 0};
+
+static int among(char *s, size_t n, char **words)
+{
+  for (char **w = words; *w; w++)
+    if (strlen(*w) == n && !strncmp(s, *w, n))
+      return 1;
+  return 0;
+}
+
+extern int openTree(char *s)
+{
+  int depth = 0, start = 1;
+  for (;;)
+  {
+    s += strspn(s, " \t");
+    size_t n = strcspn(s, " \t");
+    if (!n)
+      return depth > 0;
+    if (start && (among(s, n, (char *[]){"if", "while", "for", 0})))
+      depth++;
+    else if (start && among(s, n, (char *[]){"fi", "done", 0}))
+      depth--;
+    start = among(s, n, starts);
+    s += n;
+  }
+}
+
+extern char *continueTree(char *s, char *next)
+{
+  // The last word of s: a ; after it is needed, unless it already ends a command
+  size_t end = strlen(s);
+  while (end && strchr(" \t", s[end - 1]))
+    end--;
+  size_t begin = end;
+  while (begin && !strchr(" \t", s[begin - 1]))
+    begin--;
+  char *join = !end || among(s + begin, end - begin, starts) ? " " : " ; ";
+  char *line = malloc(strlen(s) + strlen(join) + strlen(next) + 1);
+  if (!line)
+    ERROR("malloc() failed");
+  strcpy(line, s);
+  strcat(line, join);
+  strcat(line, next);
+  free(s);
+  free(next);
+  return line;
+}
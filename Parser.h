@@ -19,4 +19,45 @@ extern Tree parseTree(char *s);
  */
 extern void freeTree(Tree t);
 
+/**
+ * @brief Switches to another session's parser state
+ * @param state State returned by an earlier swapParser(), or NULL for a new one
+ * @return The state that was in use (NULL between lines)
+ */
+extern void *swapParser(void *state);
+
+/**
+ * @brief Reads the bodies of any here-documents (<<word) in a parsed tree
+ *
+ * Here-document bodies follow the command line, so they are read after parsing, in order, up to each delimiter line
+ *
+ * @param t Parse tree returned from parseTree()
+ * @param line Line reader with the signature of readline(), called with a continuation prompt
+ * @return VOID
+ */
+extern void hereTree(Tree t, char *(*line)(const char *));
+
+/**
+ * @brief Checks if a line leaves an if, while or for open
+ *
+ * Such a line goes on in the lines after it: the caller joins them on
+ * with continueTree() until it doesn't, then parses the whole.
+ *
+ * @param s Line (or lines joined so far)
+ * @return 1 if open, 0 if not
+ */
+extern int openTree(char *s);
+
+/**
+ * @brief Joins the next line onto an open one
+ *
+ * A ; goes between them unless the first already ends where a command
+ * starts (after ;, &, then, do...).
+ *
+ * @param s Line so far, freed
+ * @param next Next line, freed
+ * @return The joined line (malloc()ed)
+ */
+extern char *continueTree(char *s, char *next);
+
 #endif
@@ -0,0 +1,259 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // sched_setaffinity(), CPU_SET()
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "Pin.h"
+#include "error.h"
+
+#define SYSCPU "/sys/devices/system/cpu"
+
+// Where one CPU sits in the machine, each domain named by its lowest CPU
+typedef struct
+{
+  int cpu;
+  int package; // socket
+  int llc;     // last-level cache
+  int core;    // physical core (SMT siblings share it)
+  int thread;  // this CPU's place among its core's siblings
+  int pos;     // its core's place among the cores under its llc
+} Cpu;
+
+static char *mode = 0; // 0 when off
+static int *order = 0; // CPU for stage i is order[i % n]
+static int n = 0;
+
+/**
+ * @brief Reads the first integer in a sysfs file (the lowest CPU of a list)
+ * @return The integer, or dflt if the file can't be read
+ */
+static int readint(char *path, int dflt)
+{
+  FILE *f = fopen(path, "re");
+  if (!f)
+    return dflt;
+  int v;
+  if (fscanf(f, "%d", &v) != 1)
+    v = dflt;
+  fclose(f);
+  return v;
+}
+
+/**
+ * @brief Parses a CPU list such as 0-3,8
+ * @return 0 on success, -1 if s is not a CPU list
+ */
+static int parselist(char *s, cpu_set_t *set)
+{
+  CPU_ZERO(set);
+  while (*s && *s != '\n')
+  {
+    char *end;
+    long lo = strtol(s, &end, 10), hi = lo;
+    if (end == s)
+      return -1;
+    if (*end == '-')
+    {
+      s = end + 1;
+      hi = strtol(s, &end, 10);
+      if (end == s)
+        return -1;
+    }
+    if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+      return -1;
+    for (long c = lo; c <= hi; c++)
+      CPU_SET(c, set);
+    s = *end == ',' ? end + 1 : end;
+  }
+  return 0;
+}
+
+/**
+ * @brief Reads the topology of one CPU
+ */
+static void topology(Cpu *c, int cpu)
+{
+  char path[256];
+  c->cpu = cpu;
+  snprintf(path, sizeof(path), SYSCPU "/cpu%d/topology/physical_package_id", cpu);
+  c->package = readint(path, 0);
+  snprintf(path, sizeof(path), SYSCPU "/cpu%d/topology/thread_siblings_list", cpu);
+  c->core = readint(path, cpu);
+  // The highest level cache listed is the last-level one
+  c->llc = c->package;
+  for (int i = 0, best = 0;; i++)
+  {
+    snprintf(path, sizeof(path), SYSCPU "/cpu%d/cache/index%d/level", cpu, i);
+    int level = readint(path, -1);
+    if (level == -1)
+      break;
+    if (level > best)
+    {
+      best = level;
+      snprintf(path, sizeof(path), SYSCPU "/cpu%d/cache/index%d/shared_cpu_list", cpu, i);
+      c->llc = readint(path, c->llc);
+    }
+  }
+}
+
+static int adjacent(const void *a, const void *b)
+{
+  const Cpu *x = a, *y = b;
+  if (x->thread != y->thread)
+    return x->thread - y->thread;
+  if (x->package != y->package)
+    return x->package - y->package;
+  if (x->llc != y->llc)
+    return x->llc - y->llc;
+  if (x->core != y->core)
+    return x->core - y->core;
+  return x->cpu - y->cpu;
+}
+
+static int spread(const void *a, const void *b)
+{
+  const Cpu *x = a, *y = b;
+  if (x->thread != y->thread)
+    return x->thread - y->thread;
+  if (x->pos != y->pos)
+    return x->pos - y->pos;
+  if (x->package != y->package)
+    return x->package - y->package;
+  if (x->llc != y->llc)
+    return x->llc - y->llc;
+  return x->cpu - y->cpu;
+}
+
+/**
+ * @brief Orders the allowed CPUs by topology
+ * @return Number of CPUs in o
+ */
+static int place(cpu_set_t *allowed, int (*cmp)(const void *, const void *), int *o)
+{
+  Cpu *cpus = malloc(sizeof(Cpu) * CPU_COUNT(allowed));
+  if (!cpus)
+    ERROR("malloc() failed");
+  int k = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    if (CPU_ISSET(cpu, allowed))
+      topology(&cpus[k++], cpu);
+  // A core's threads, and an llc's cores, are numbered in CPU order
+  for (int i = 0; i < k; i++)
+  {
+    cpus[i].thread = 0;
+    for (int j = 0; j < i; j++)
+      if (cpus[j].core == cpus[i].core)
+        cpus[i].thread++;
+  }
+  for (int i = 0; i < k; i++)
+  {
+    cpus[i].pos = 0;
+    for (int j = 0; j < k; j++)
+      if (!cpus[j].thread && cpus[j].llc == cpus[i].llc && cpus[j].core < cpus[i].core)
+        cpus[i].pos++;
+  }
+  qsort(cpus, k, sizeof(Cpu), cmp);
+  for (int i = 0; i < k; i++)
+    o[i] = cpus[i].cpu;
+  free(cpus);
+  return k;
+}
+
+extern int setPin(char *m)
+{
+  cpu_set_t allowed, want;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed))
+    return -1;
+  int (*cmp)(const void *, const void *) = 0;
+  if (!strcmp(m, "off"))
+  {
+    freePin();
+    return 0;
+  }
+  if (!strcmp(m, "adjacent"))
+    cmp = adjacent;
+  else if (!strcmp(m, "spread"))
+    cmp = spread;
+  else if (strncmp(m, "cpus=", 5) || parselist(m + 5, &want))
+    return -1;
+
+  int *o = malloc(sizeof(int) * CPU_COUNT(&allowed));
+  if (!o)
+    ERROR("malloc() failed");
+  int k = 0;
+  if (cmp)
+    k = place(&allowed, cmp, o);
+  else
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &want) && CPU_ISSET(cpu, &allowed))
+        o[k++] = cpu;
+  if (!k)
+  {
+    free(o);
+    return -1;
+  }
+  freePin();
+  mode = strdup(m);
+  order = o;
+  n = k;
+  return 0;
+}
+
+extern void stagePin(int stage)
+{
+  if (!mode)
+    return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(order[stage % n], &set);
+  sched_setaffinity(0, sizeof(set), &set); // a failure just leaves it unpinned
+}
+
+extern void printPin(FILE *f)
+{
+  if (!mode)
+  {
+    fprintf(f, "off\n");
+    return;
+  }
+  fprintf(f, "%s:", mode);
+  for (int i = 0; i < n; i++)
+    fprintf(f, " %d", order[i]);
+  fprintf(f, "\n");
+}
+
+extern void freePin()
+{
+  free(mode);
+  free(order);
+  mode = 0;
+  order = 0;
+  n = 0;
+}
+
+// What swapPin() saves of the state above
+typedef struct
+{
+  char *mode;
+  int *order;
+  int n;
+} *PinState;
+
+extern void *swapPin(void *state)
+{
+  PinState old = malloc(sizeof(*old));
+  if (!old)
+    ERROR("malloc() failed");
+  old->mode = mode;
+  old->order = order;
+  old->n = n;
+  PinState s = state;
+  mode = s ? s->mode : 0;
+  order = s ? s->order : 0;
+  n = s ? s->n : 0;
+  free(s);
+  return old;
+}
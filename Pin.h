@@ -0,0 +1,63 @@
+#ifndef PIN_H
+#define PIN_H
+
+#include <stdio.h>
+
+/**
+ * CPU placement of pipeline stages
+ *
+ * With pinning on, stage i of a pipeline is bound (sched_setaffinity) to
+ * one CPU from an order worked out once, when the mode is set, from the
+ * topology in /sys/devices/system/cpu:
+ *
+ *   adjacent  neighbouring stages on neighbouring cores, so a pipe is
+ *             shared by cores under the same cache (one thread per core
+ *             first, SMT siblings only once every core has a stage)
+ *   spread    neighbouring stages on different last-level caches/sockets
+ *   cpus=L    stages take the CPUs of the list L (e.g. 0-3,8) in turn
+ *   off       no pinning (the default)
+ *
+ * Only CPUs the shell is allowed to run on are used.
+ */
+
+/**
+ * @brief Sets the placement mode
+ * @param mode "off", "adjacent", "spread" or "cpus=LIST"
+ * @return 0 on success, -1 if the mode is invalid or leaves no CPUs
+ */
+extern int setPin(char *mode);
+
+/**
+ * @brief Binds the calling process to the CPU for a pipeline stage
+ *
+ * Called in the child after fork(), so the program it execs inherits
+ * the binding. Does nothing when pinning is off.
+ *
+ * @param stage Stage number within the pipeline, from 0
+ * @return VOID
+ */
+extern void stagePin(int stage);
+
+/**
+ * @brief Prints the mode and the CPU order stages are placed in
+ * @param f Stream to print to
+ * @return VOID
+ */
+extern void printPin(FILE *f);
+
+/**
+ * @brief Frees the CPU order
+ * @return VOID
+ */
+extern void freePin();
+
+/**
+ * @brief Switches to another session's mode and CPU order
+ * @param state State returned by an earlier swapPin(), or NULL for a new
+ *              one (off); it is taken over
+ * @return The state that was in use, freed with free() once freePin() has
+ *         freed what it holds
+ */
+extern void *swapPin(void *state);
+
+#endif
@@ -1,30 +1,72 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // pipe2(), tee(), splice()
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
 #include "Pipeline.h"
 #include "Command.h"
+#include "Vars.h"
+#include "Pin.h"
+#include "Prio.h"
+#include "Stats.h"
+#include "Deadline.h"
+#include "Capture.h"
+#include "Results.h"
+#include "Replica.h"
+#include "Meter.h"
+#define ALLOC_MODULE AL_PIPELINE
+#include "Alloc.h"
 #include "deq.h"
 #include "error.h"
 
+// How a command after |[N] is replicated
+typedef struct
+{
+  int n;
+  int spread; // REPLICA_*
+} *Copies;
+
 typedef struct
 {
   Deq processes;
-  int fg; // not "&"
+  Deq copies; // a Copies (or 0) for each command, or 0 if none is replicated
+  Deq tees; // fan-out branches fed by the last command (|&), or 0
+  int fg;   // not "&"
+  int last; // nothing runs after this pipeline
+  int cond; // run only if the previous status was 0 (1, &&), non-0 (-1, ||), or always (0)
+  Deq pids; // processes of a background pipeline, last command's last
+  long timeout; // deadline in ms (timeout DURATION), or 0 for the default
+  int capture;  // number of a background job's output capture (see Capture.h), or 0
+  int capfd;    // write end of the capture while the job is being forked, or -1
 } *PipelineRep;
 
+// Most data tee()/splice() move per call: one default pipe's capacity
+#define RELAYSIZE (1 << 16)
+
 extern Pipeline newPipeline(int fg)
 {
-  PipelineRep r = (PipelineRep)malloc(sizeof(*r));
+  PipelineRep r = (PipelineRep)newAlloc(AL_PIPELINE, sizeof(*r));
   if (!r)
   {
     ERROR("malloc() failed");
   }
   r->processes = deq_new();
+  r->copies = 0;
+  r->tees = 0;
   r->fg = fg;
+  r->last = 0;
+  r->cond = 0;
+  r->pids = 0;
+  r->timeout = 0;
+  r->capture = 0;
+  r->capfd = -1;
   return r;
 }
 
@@ -32,6 +74,115 @@ extern void addPipeline(Pipeline pipeline, Command command)
 {
   PipelineRep r = (PipelineRep)pipeline;
   deq_tail_put(r->processes, command);
+  if (r->copies)
+    deq_tail_put(r->copies, 0);
+}
+
+// The command added last runs as n copies
+extern void copiesPipeline(Pipeline pipeline, int n, int spread)
+{
+  PipelineRep r = (PipelineRep)pipeline;
+  if (!r->copies)
+  {
+    r->copies = deq_new();
+    for (int i = 0; i < deq_len(r->processes); i++)
+      deq_tail_put(r->copies, 0);
+  }
+  Copies c = malloc(sizeof(*c));
+  if (!c)
+    ERROR("malloc() failed");
+  c->n = n;
+  c->spread = spread;
+  free(deq_tail_get(r->copies));
+  deq_tail_put(r->copies, c);
+}
+
+extern void lastPipeline(Pipeline pipeline)
+{
+  PipelineRep r = (PipelineRep)pipeline;
+  r->last = 1;
+}
+
+extern void condPipeline(Pipeline pipeline, int cond)
+{
+  PipelineRep r = (PipelineRep)pipeline;
+  r->cond = cond;
+}
+
+extern void timeoutPipeline(Pipeline pipeline, long ms)
+{
+  PipelineRep r = (PipelineRep)pipeline;
+  r->timeout = ms;
+}
+
+// Deadline a foreground pipeline is waited for with, 0 for none
+extern long deadlinePipeline(Pipeline pipeline)
+{
+  PipelineRep r = (PipelineRep)pipeline;
+  if (!r->fg)
+    return 0;
+  return r->timeout ? r->timeout : getDeadline();
+}
+
+extern void teePipeline(Pipeline pipeline, Pipeline branch)
+{
+  PipelineRep r = (PipelineRep)pipeline;
+  if (!r->tees)
+    r->tees = deq_new();
+  deq_tail_put(r->tees, branch);
+}
+
+extern void pidPipeline(Pipeline pipeline, int pid)
+{
+  PipelineRep r = (PipelineRep)pipeline;
+  if (!r->pids)
+    r->pids = deq_new();
+  deq_tail_put(r->pids, (Data)(long)pid);
+  backgroundCommand(pid);
+}
+
+extern int bgPipeline(Pipeline pipeline)
+{
+  PipelineRep r = (PipelineRep)pipeline;
+  return !r->fg;
+}
+
+extern int fgPipeline(Pipeline pipeline)
+{
+  PipelineRep r = (PipelineRep)pipeline;
+  int status = -1;
+  while (r->pids && deq_len(r->pids))
+  {
+    int s = foregroundCommand((int)(long)deq_head_get(r->pids));
+    if (s >= 0)
+      status = s;
+  }
+  return status;
+}
+
+extern int capturePipeline(Pipeline pipeline)
+{
+  PipelineRep r = (PipelineRep)pipeline;
+  return r->capfd;
+}
+
+extern int outputPipeline(Pipeline pipeline)
+{
+  PipelineRep r = (PipelineRep)pipeline;
+  return r->capture ? outputCapture(r->capture) : -1;
+}
+
+// Prints a background job as jobs lists it: [n], Running or Done, and its processes
+extern void printPipeline(Pipeline pipeline, int n)
+{
+  PipelineRep r = (PipelineRep)pipeline;
+  int running = 0;
+  for (int i = 0; r->pids && i < deq_len(r->pids); i++)
+    running |= runningCommand((int)(long)deq_head_ith(r->pids, i));
+  printf("[%d] %s", n, running ? "Running" : "Done");
+  for (int i = 0; r->pids && i < deq_len(r->pids); i++)
+    printf(" %d", (int)(long)deq_head_ith(r->pids, i));
+  putchar('\n');
 }
 
 extern int sizePipeline(Pipeline pipeline)
@@ -40,189 +191,564 @@ extern int sizePipeline(Pipeline pipeline)
   return deq_len(r->processes);
 }
 
-// Helper to execute a command with proper I/O redirection for pipes
-static void exec_command_in_pipeline(Command command, int input_fd, int output_fd)
+/**
+ * @brief Moves exactly n bytes from pipe src to dst with splice()
+ *
+ * A consumer that has gone away (EPIPE) is swapped for /dev/null, so the
+ * data is still drained and the other consumers keep going.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int move(int src, int *dst, size_t n)
 {
-  // Redirect stdin if needed
-  if (input_fd != STDIN_FILENO)
+  while (n)
   {
-    if (dup2(input_fd, STDIN_FILENO) == -1)
+    ssize_t m = splice(src, 0, *dst, 0, n, SPLICE_F_MOVE);
+    if (m == -1 && errno == EPIPE)
     {
-      ERROR("dup2() failed for stdin");
+      close(*dst);
+      *dst = open("/dev/null", O_WRONLY | O_CLOEXEC);
+      continue;
     }
-    close(input_fd);
+    if (m <= 0)
+      return -1;
+    n -= m;
   }
+  return 0;
+}
 
-  // Redirect stdout if needed
-  if (output_fd != STDOUT_FILENO)
+/**
+ * @brief Duplicates exactly t bytes at the front of pipe src to *out, then moves them to *dst
+ * @return 0 on success, -1 on error
+ */
+static int forward(int src, int *out, int *dst, size_t t)
+{
+  while (t && *out != -1)
   {
-    if (dup2(output_fd, STDOUT_FILENO) == -1)
+    ssize_t d = tee(src, *out, t, 0);
+    if (d == -1 && errno == EPIPE)
     {
-      ERROR("dup2() failed for stdout");
+      close(*out);
+      *out = -1;
+      break;
     }
-    close(output_fd);
+    if (d <= 0 || move(src, dst, d))
+      return -1;
+    t -= d;
   }
+  return t ? move(src, dst, t) : 0;
+}
 
-  // Execute the command (this will replace the process)
-  typedef struct
+/**
+ * @brief Copies everything read from pipe in to each of the k pipes in out
+ *
+ * Runs in a forked relay process and never copies data into user space.
+ * The k consumers are fed by a chain of links: link j tee()s its source to
+ * out[j], then splice()s the same bytes on to the source of link j+1 (a
+ * private pipe) or, for the last link, to out[k-1]. tee() always starts at
+ * the front of a pipe, so each link forwards exactly what it duplicated
+ * before duplicating more.
+ */
+static void relay(int in, int *out, int k)
+{
+  signal(SIGPIPE, SIG_IGN); // dead consumers show up as EPIPE
+  if (k == 1)
+  {
+    while (splice(in, 0, out[0], 0, RELAYSIZE, SPLICE_F_MOVE) > 0)
+      ;
+    return;
+  }
+  int *src = malloc(sizeof(int) * k);
+  int *dst = malloc(sizeof(int) * k);
+  if (!src || !dst)
+    ERROR("malloc() failed");
+  src[0] = in;
+  for (int j = 0; j < k - 2; j++)
   {
-    char *file;
-    char **argv;
-  } *CommandRep;
+    int mid[2];
+    if (pipe2(mid, O_CLOEXEC) == -1)
+      ERROR("pipe2() failed");
+    countStats(ST_PIPES);
+    dst[j] = mid[1];
+    src[j + 1] = mid[0];
+  }
+  dst[k - 2] = out[k - 1];
 
-  CommandRep r = command;
-  execvp(r->argv[0], r->argv);
-  ERROR("execvp() failed");
-  exit(EXIT_FAILURE);
+  for (;;)
+  {
+    // Link 0 decides how much moves through the chain this round
+    ssize_t t;
+    if (out[0] != -1)
+    {
+      t = tee(in, out[0], RELAYSIZE, 0);
+      if (t == -1 && errno == EPIPE)
+      {
+        close(out[0]);
+        out[0] = -1;
+        continue;
+      }
+      if (t <= 0 || move(in, &dst[0], t))
+        break;
+    }
+    else
+    {
+      t = splice(in, 0, dst[0], 0, RELAYSIZE, SPLICE_F_MOVE);
+      if (t <= 0)
+        break;
+    }
+    // Later links forward exactly t bytes each
+    int j;
+    for (j = 1; j < k - 1; j++)
+      if (forward(src[j], &out[j], &dst[j], t))
+        break;
+    if (j < k - 1)
+      break;
+  }
+  free(src);
+  free(dst);
 }
 
-static void execute(Pipeline pipeline, Jobs jobs, int *jobbed, int *eof)
+// A forked child's setup before it runs: deadline group, capture, CPU and priority
+static void child(PipelineRep r, int s, pid_t *group, int capture, int out)
 {
-  PipelineRep r = (PipelineRep)pipeline;
-  int n = sizePipeline(pipeline);
+  if (group)
+    joinDeadline(0, *group);
+  childCapture(capture, out);
+  stagePin(s);
+  if (!r->fg)
+    bgPrio();
+}
 
-  // Special case: single command (no pipes needed)
-  if (n == 1)
+// The shell's side of a fork: counted, recorded, kept to be waited for
+static void forked(pid_t pid, char **argv, Deq pids, pid_t *group)
+{
+  forkStats(pid);
+  stageResults(argv, pid);
+  deq_tail_put(pids, (Data)(long)pid);
+  if (group)
   {
-    execCommand(deq_head_ith(r->processes, 0), pipeline, jobs, jobbed, eof, r->fg);
-    return;
+    joinDeadline(pid, *group);
+    if (!*group)
+      *group = pid;
   }
+}
 
-  // Multiple commands: need pipes
-  int **pipes = (int **)malloc(sizeof(int *) * (n - 1));
-  if (!pipes)
+/**
+ * @brief Forks the copies of a replicated stage (|[N]), with its splitter and merger
+ *
+ * Each copy reads a pipe of its own, fed by the splitter from in, and
+ * writes one, read by the merger into out (see Replica.h). They are
+ * stages of their own: the copies, then the splitter, then the merger.
+ * The command's redirections are the stage's: the splitter applies its
+ * input ones and the merger its output one (see redirCommand()).
+ * None of them need exec, so each closes the ends it has no use for, or
+ * a copy would never see the end of its input.
+ *
+ * @param next Pipe to the next stage, or {-1, -1} for stdout
+ * @return Pid of the last copy
+ */
+static pid_t replicate(PipelineRep r, Command cmd, Copies c, int in, int *next, Deq pids, int *stage,
+                       pid_t *group, int capture)
+{
+  int n = c->n, out = next[1];
+  int *to = malloc(sizeof(int) * 2 * n);
+  if (!to)
     ERROR("malloc() failed");
+  int *from = to + n;
+  int order[2] = {-1, -1};
+  if ((c->spread & REPLICA_ORDER) && pipe2(order, O_CLOEXEC) == -1)
+    ERROR("pipe2() failed");
+  if (order[0] != -1)
+    countStats(ST_PIPES);
 
-  // Create all pipes
-  for (int i = 0; i < n - 1; i++)
+  char **argv = argsCommand(cmd);
+  pid_t pid = -1;
+  for (int j = 0; j < n; j++)
   {
-    pipes[i] = (int *)malloc(sizeof(int) * 2);
-    if (!pipes[i])
-      ERROR("malloc() failed");
-    if (pipe(pipes[i]) == -1)
-      ERROR("pipe() failed");
+    int a[2], b[2];
+    if (pipe2(a, O_CLOEXEC) == -1 || pipe2(b, O_CLOEXEC) == -1)
+      ERROR("pipe2() failed");
+    countStats(ST_PIPES);
+    countStats(ST_PIPES);
+    int s = (*stage)++;
+    pid = fork();
+    if (pid == -1)
+      ERROR("fork() failed");
+    if (pid == 0)
+    {
+      child(r, s, group, capture, 0);
+      for (int i = 0; i < j; i++)
+      {
+        close(to[i]);
+        close(from[i]);
+      }
+      close(in);
+      if (out != -1)
+      {
+        close(next[0]);
+        close(out);
+      }
+      if (order[0] != -1)
+      {
+        close(order[0]);
+        close(order[1]);
+      }
+      if (dup2(a[0], STDIN_FILENO) == -1 || dup2(b[1], STDOUT_FILENO) == -1)
+        ERROR("dup2() failed");
+      close(a[0]);
+      close(a[1]);
+      close(b[0]);
+      close(b[1]);
+      redirCommand(cmd, 0, 0);
+      childCommand(cmd);
+    }
+    forked(pid, argv, pids, group);
+    close(a[0]);
+    close(b[1]);
+    to[j] = a[1];
+    from[j] = b[0];
   }
 
-  // Add pipeline to jobs if needed
-  if (!*jobbed)
+  int s = (*stage)++;
+  pid_t split = fork();
+  if (split == -1)
+    ERROR("fork() failed");
+  if (split == 0)
   {
-    *jobbed = 1;
-    addJobs(jobs, pipeline);
+    child(r, s, group, capture, 0);
+    for (int i = 0; i < n; i++)
+      close(from[i]);
+    if (out != -1)
+    {
+      close(next[0]);
+      close(out);
+    }
+    if (order[0] != -1)
+      close(order[0]);
+    if (dup2(in, STDIN_FILENO) == -1)
+      ERROR("dup2() failed");
+    close(in);
+    if (redirCommand(cmd, 1, 0))
+      _exit(EXIT_FAILURE);
+    splitReplica(STDIN_FILENO, to, n, c->spread, order[1]);
+    _exit(EXIT_SUCCESS);
   }
+  forked(split, 0, pids, group);
 
-  // Fork and execute each command
-  pid_t *pids = (pid_t *)malloc(sizeof(pid_t) * n);
-  if (!pids)
-    ERROR("malloc() failed");
+  s = (*stage)++;
+  pid_t merge = fork();
+  if (merge == -1)
+    ERROR("fork() failed");
+  if (merge == 0)
+  {
+    child(r, s, group, capture, out == -1);
+    for (int i = 0; i < n; i++)
+      close(to[i]);
+    close(in);
+    if (out != -1)
+      close(next[0]);
+    if (order[1] != -1)
+      close(order[1]);
+    if (out != -1)
+    {
+      if (dup2(out, STDOUT_FILENO) == -1)
+        ERROR("dup2() failed");
+      close(out);
+    }
+    if (redirCommand(cmd, 0, 1))
+      _exit(EXIT_FAILURE);
+    mergeReplica(from, n, STDOUT_FILENO, order[0]);
+    _exit(EXIT_SUCCESS);
+  }
+  forked(merge, 0, pids, group);
 
-  for (int i = 0; i < n; i++)
+  for (int i = 0; i < 2 * n; i++)
+    close(to[i]);
+  if (order[0] != -1)
   {
-    pids[i] = fork();
-    if (pids[i] == -1)
-      ERROR("fork() failed");
+    close(order[0]);
+    close(order[1]);
+  }
+  free(to);
+  return pid;
+}
 
-    if (pids[i] == 0)
+/**
+ * @brief Forks every command of a pipeline, connected by pipes
+ *
+ * Pipes are created one stage ahead of the fork that needs them, with
+ * O_CLOEXEC, so the shell never holds more than one pipe at a time and a
+ * child only touches its own two ends: everything else it inherited is
+ * closed by execvp(). The parent closes each end as soon as the child it
+ * belongs to has been forked, which keeps setup linear in the number of
+ * stages and within the fd limit for very long pipelines.
+ *
+ * If the pipeline fans out (|&), the last command writes into a pipe read
+ * by a relay process, which duplicates it into one pipe per branch, and
+ * each branch is spawned the same way reading from its own pipe.
+ *
+ * A replicated command (|[N]) is forked as its copies, between a splitter
+ * and a merger, see replicate().
+ *
+ * Each child is placed on its stage's CPU (see pin) before it execs.
+ *
+ * @param r Pipeline to spawn
+ * @param in Read end of a pipe for the first command's stdin, or -1
+ * @param pids Every pid forked is added here
+ * @param stage Number of the next stage, counted over the branches too
+ * @param group Process group of a timed pipeline (0 until the first fork), or NULL
+ * @param capture Write end of a background job's output capture, or -1
+ * @return Pid of the last command
+ */
+static pid_t spawn(PipelineRep r, int in, Deq pids, int *stage, pid_t *group, int capture)
+{
+  pid_t pid = -1;
+  int n = deq_len(r->processes);
+  for (int i = 0; i < n; i++)
+  {
+    // Rotate through the commands so each lookup is O(1)
+    Command cmd = deq_head_get(r->processes);
+    deq_tail_put(r->processes, cmd);
+    Copies c = 0;
+    if (r->copies)
     {
-      // Child process
-      typedef struct
-      {
-        char *file;
-        char **argv;
-        char *input;
-        char *output;
-      } *CommandRep;
+      c = deq_head_get(r->copies);
+      deq_tail_put(r->copies, c);
+    }
 
-      CommandRep cmd = deq_head_ith(r->processes, i);
+    // Not the last command (or fanning out), create the pipe to the next one
+    int fd[2] = {-1, -1};
+    if ((i < n - 1 || r->tees) && pipe2(fd, O_CLOEXEC) == -1)
+      ERROR("pipe2() failed");
+    if (fd[0] != -1)
+      countStats(ST_PIPES);
 
-      // Set up input redirection
-      if (i > 0)
-      {
-        // Not the first command, read from previous pipe
-        if (dup2(pipes[i - 1][0], STDIN_FILENO) == -1)
-          ERROR("dup2() failed");
-      }
-      // Override with file redirection if specified
-      if (cmd->input)
+    if (c && c->n > 1)
+      pid = replicate(r, cmd, c, in, fd, pids, stage, group, capture);
+    else
+    {
+      // Expanded here, so globs go through the shell's directory cache, not a child's copy
+      char **argv = argsCommand(cmd);
+      int s = (*stage)++;
+      pid = fork();
+      if (pid == -1)
+        ERROR("fork() failed");
+
+      if (pid == 0)
       {
-        int fd = open(cmd->input, O_RDONLY);
-        if (fd == -1)
+        child(r, s, group, capture, fd[1] == -1);
+        // Child process: read from previous pipe, write to next pipe
+        if (in != -1)
         {
-          ERROR("failed to open input file");
-          exit(EXIT_FAILURE);
+          if (dup2(in, STDIN_FILENO) == -1)
+            ERROR("dup2() failed");
+          close(in);
         }
-        if (dup2(fd, STDIN_FILENO) == -1)
-          ERROR("dup2() failed");
-        close(fd);
-      }
-
-      // Set up output redirection
-      if (i < n - 1)
-      {
-        // Not the last command, write to next pipe
-        if (dup2(pipes[i][1], STDOUT_FILENO) == -1)
-          ERROR("dup2() failed");
-      }
-      // Override with file redirection if specified
-      if (cmd->output)
-      {
-        int fd = open(cmd->output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-        if (fd == -1)
+        if (fd[1] != -1)
         {
-          ERROR("failed to open output file");
-          exit(EXIT_FAILURE);
+          if (dup2(fd[1], STDOUT_FILENO) == -1)
+            ERROR("dup2() failed");
+          close(fd[0]);
+          close(fd[1]);
         }
-        if (dup2(fd, STDOUT_FILENO) == -1)
-          ERROR("dup2() failed");
-        close(fd);
-      }
 
-      // Close all pipe file descriptors in child
-      for (int j = 0; j < n - 1; j++)
-      {
-        close(pipes[j][0]);
-        close(pipes[j][1]);
+        // Execute the command, file redirections override the pipes
+        childCommand(cmd);
       }
-
-      // Execute the command
-      execvp(cmd->argv[0], cmd->argv);
-      ERROR("execvp() failed");
-      exit(EXIT_FAILURE);
+      forked(pid, argv, pids, group);
     }
+
+    // Parent process: both ends have been handed off
+    if (in != -1)
+      close(in);
+    if (fd[1] != -1)
+      close(fd[1]);
+    in = fd[0];
   }
+  if (!r->tees)
+    return pid;
+  pid_t last = pid;
 
-  // Parent process: close all pipes
-  for (int i = 0; i < n - 1; i++)
+  // Fan out: one pipe per branch, fed by the relay
+  int k = deq_len(r->tees);
+  int *out = malloc(sizeof(int) * k);
+  if (!out)
+    ERROR("malloc() failed");
+  for (int j = 0; j < k; j++)
   {
-    close(pipes[i][0]);
-    close(pipes[i][1]);
-    free(pipes[i]);
+    int fd[2];
+    if (pipe2(fd, O_CLOEXEC) == -1)
+      ERROR("pipe2() failed");
+    countStats(ST_PIPES);
+    spawn(deq_head_ith(r->tees, j), fd[0], pids, stage, group, capture);
+    out[j] = fd[1];
   }
-  free(pipes);
+  int s = (*stage)++;
+  pid = fork();
+  if (pid == -1)
+    ERROR("fork() failed");
+  if (pid == 0)
+  {
+    child(r, s, group, capture, 0);
+    relay(in, out, k);
+    _exit(EXIT_SUCCESS);
+  }
+  forked(pid, 0, pids, group);
+  close(in);
+  for (int j = 0; j < k; j++)
+    close(out[j]);
+  free(out);
+  return last;
+}
 
-  // Wait for all children if foreground
-  if (r->fg)
+// The job's children have all been forked: only they keep its capture open
+static void uncapture(PipelineRep r)
+{
+  if (r->capfd == -1)
+    return;
+  close(r->capfd);
+  r->capfd = -1;
+}
+
+/**
+ * @brief Runs a pipeline, waiting for it if it is in the foreground
+ * @return Exit status of the last command, 0 if in the background
+ */
+static int execute(Pipeline pipeline, Jobs jobs, int *jobbed, int *eof)
+{
+  PipelineRep r = (PipelineRep)pipeline;
+  int n = sizePipeline(pipeline);
+
+  // A background job's output may be captured: every stage's, down one pipe
+  if (!r->fg)
+    r->capture = newCapture(&r->capfd);
+
+  // Special case: single command (no pipes needed)
+  if (n == 1 && !r->tees)
+  {
+    int status = execCommand(deq_head_ith(r->processes, 0), pipeline, jobs, jobbed, eof, r->fg, r->last);
+    uncapture(r);
+    return status;
+  }
+
+  // Add pipeline to jobs if needed: only a background one can be brought back by fg
+  if (!r->fg && !*jobbed)
   {
+    *jobbed = 1;
+    addJobs(jobs, pipeline);
+  }
+
+  // Fork and execute each command, sharing one cached exec environment
+  envVars();
+  fflush(stdout);
+  Deq pids = deq_new();
+  int stage = 0;
+  long ms = deadlinePipeline(pipeline);
+  pid_t group = 0;
+  pid_t last = spawn(r, -1, pids, &stage, ms ? &group : 0, r->capfd);
+  uncapture(r);
+
+  // Metered, its stages are sampled while it is waited for (see Meter.h)
+  Meter meter = 0;
+  if (r->fg && onMeter())
+  {
+    int n = deq_len(pids);
+    int *all = malloc(sizeof(int) * n);
+    if (!all)
+      ERROR("malloc() failed");
+    for (int i = 0; i < n; i++)
+      all[i] = (pid_t)(long)deq_head_ith(pids, i);
+    meter = startMeter(all, n);
+    free(all);
+  }
+
+  // With a deadline, all of them are waited for at once, by pidfd
+  int status = 0;
+  if (ms)
+  {
+    int n = deq_len(pids), at = 0;
+    int *all = malloc(sizeof(int) * n);
+    if (!all)
+      ERROR("malloc() failed");
     for (int i = 0; i < n; i++)
+      if ((all[i] = (pid_t)(long)deq_head_get(pids)) == last)
+        at = i;
+    status = waitDeadline(all, n, at, ms);
+    free(all);
+  }
+
+  // Wait for all children if foreground, the last command decides the status.
+  // In the background they are kept instead, to be reaped or brought back by fg
+  while (deq_len(pids))
+  {
+    pid_t pid = (pid_t)(long)deq_head_get(pids);
+    if (!r->fg)
     {
-      int status;
-      waitpid(pids[i], &status, 0);
+      if (pid != last)
+        pidPipeline(pipeline, pid);
+      continue;
     }
+    int s = waitCommand(pid);
+    if (pid == last)
+      status = s;
   }
+  if (!r->fg)
+    pidPipeline(pipeline, last);
+  endMeter(meter);
 
-  free(pids);
+  deq_del(pids, 0);
+  return status;
 }
 
-extern void execPipeline(Pipeline pipeline, Jobs jobs, int *eof)
+extern int execPipeline(Pipeline pipeline, Jobs jobs, int *eof, int status)
 {
+  PipelineRep r = (PipelineRep)pipeline;
+  // Skipped by && or ||, the previous status stands
+  if ((r->cond > 0 && status) || (r->cond < 0 && !status))
+  {
+    freePipeline(pipeline);
+    return status;
+  }
   int jobbed = 0;
-  execute(pipeline, jobs, &jobbed, eof);
+  startResults(!r->fg);
+  status = execute(pipeline, jobs, &jobbed, eof);
+  endResults(status);
   if (!jobbed)
     freePipeline(pipeline);
+  return status;
+}
+
+extern int runPipeline(Pipeline pipeline, Jobs jobs, int *eof, int status)
+{
+  PipelineRep r = (PipelineRep)pipeline;
+  if ((r->cond > 0 && status) || (r->cond < 0 && !status))
+    return status;
+  // Never made a job itself, it may run again...
+  int jobbed = 1;
+  startResults(!r->fg);
+  status = execute(pipeline, jobs, &jobbed, eof);
+  endResults(status);
+  if (r->fg)
+    return status;
+  // ...so what fg needs of a background run becomes a job of its own
+  PipelineRep job = newPipeline(0);
+  job->pids = r->pids;
+  job->capture = r->capture;
+  r->pids = 0;
+  r->capture = 0;
+  addJobs(jobs, job);
+  return status;
 }
 
 extern void freePipeline(Pipeline pipeline)
 {
   PipelineRep r = (PipelineRep)pipeline;
   deq_del(r->processes, freeCommand);
-  free(r);
+  if (r->copies)
+    deq_del(r->copies, free);
+  if (r->tees)
+    deq_del(r->tees, freePipeline);
+  if (r->pids)
+    deq_del(r->pids, 0);
+  freeAlloc(r, sizeof(*r));
 }
\ No newline at end of file
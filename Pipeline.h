@@ -8,8 +8,21 @@ typedef void *Pipeline;
 
 extern Pipeline newPipeline(int fg);
 extern void addPipeline(Pipeline pipeline, Command command);
+extern void copiesPipeline(Pipeline pipeline, int n, int spread);
+extern void teePipeline(Pipeline pipeline, Pipeline branch);
+extern void lastPipeline(Pipeline pipeline);
+extern void condPipeline(Pipeline pipeline, int cond);
+extern void timeoutPipeline(Pipeline pipeline, long ms);
+extern long deadlinePipeline(Pipeline pipeline);
+extern void pidPipeline(Pipeline pipeline, int pid);
+extern int bgPipeline(Pipeline pipeline);
+extern int fgPipeline(Pipeline pipeline);
+extern int capturePipeline(Pipeline pipeline);
+extern int outputPipeline(Pipeline pipeline);
+extern void printPipeline(Pipeline pipeline, int n);
 extern int sizePipeline(Pipeline pipeline);
-extern void execPipeline(Pipeline pipeline, Jobs jobs, int *eof);
+extern int execPipeline(Pipeline pipeline, Jobs jobs, int *eof, int status);
+extern int runPipeline(Pipeline pipeline, Jobs jobs, int *eof, int status);
 extern void freePipeline(Pipeline pipeline);
 
 #endif
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+#include "Prio.h"
+#include "error.h"
+
+// From linux/ioprio.h, which glibc doesn't wrap
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO(class, data) (((class) << IOPRIO_CLASS_SHIFT) | (data))
+
+static int bgnice = 10;
+static int bgio = IOPRIO(IOPRIO_CLASS_BE, 7); // 0 leaves it alone
+
+extern int setPrio(int n, char *io)
+{
+  int p = bgio;
+  if (n < -20 || n > 19)
+    return -1;
+  if (!io)
+    ;
+  else if (!strcmp(io, "none"))
+    p = 0;
+  else if (!strcmp(io, "idle"))
+    p = IOPRIO(IOPRIO_CLASS_IDLE, 0);
+  else
+  {
+    int level;
+    char end;
+    if (sscanf(io, "be:%d%c", &level, &end) != 1 || level < 0 || level > 7)
+      return -1;
+    p = IOPRIO(IOPRIO_CLASS_BE, level);
+  }
+  bgnice = n;
+  bgio = p;
+  return 0;
+}
+
+extern void bgPrio()
+{
+  // Failures (e.g. a nice below the shell's own) leave the job as it was
+  setpriority(PRIO_PROCESS, 0, bgnice);
+  if (bgio)
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, bgio);
+}
+
+extern void fgPrio(int pid)
+{
+  // Without the privilege to raise it again, the nice value stays as it is
+  errno = 0;
+  int n = getpriority(PRIO_PROCESS, 0);
+  if (!errno)
+    setpriority(PRIO_PROCESS, pid, n);
+  int p = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+  if (bgio && p != -1)
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, p);
+}
+
+extern void printPrio(FILE *f)
+{
+  int class = bgio >> IOPRIO_CLASS_SHIFT;
+  int data = bgio & ((1 << IOPRIO_CLASS_SHIFT) - 1);
+  if (!bgio)
+    fprintf(f, "%d none\n", bgnice);
+  else if (class == IOPRIO_CLASS_IDLE)
+    fprintf(f, "%d idle\n", bgnice);
+  else
+    fprintf(f, "%d be:%d\n", bgnice, data);
+}
+
+// What swapPrio() saves of the state above
+typedef struct
+{
+  int bgnice;
+  int bgio;
+} *PrioState;
+
+extern void *swapPrio(void *state)
+{
+  PrioState old = malloc(sizeof(*old));
+  if (!old)
+    ERROR("malloc() failed");
+  old->bgnice = bgnice;
+  old->bgio = bgio;
+  PrioState s = state;
+  bgnice = s ? s->bgnice : 10;
+  bgio = s ? s->bgio : IOPRIO(IOPRIO_CLASS_BE, 7);
+  free(s);
+  return old;
+}
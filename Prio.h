@@ -0,0 +1,58 @@
+#ifndef PRIO_H
+#define PRIO_H
+
+#include <stdio.h>
+
+/**
+ * CPU and I/O priority of background jobs
+ *
+ * Processes started by a background pipeline (&) run at a nice value
+ * and I/O priority class of their own (by default nice 10 and
+ * best-effort level 7), so a batch job doesn't compete equally with the
+ * foreground command being waited on. A job brought back with fg gets
+ * the shell's own priorities again. Raising the CPU priority back is
+ * only allowed with CAP_SYS_NICE or a large enough RLIMIT_NICE; the I/O
+ * priority can always be given back.
+ */
+
+/**
+ * @brief Sets the priorities for background jobs
+ * @param nice Nice value, -20..19
+ * @param io I/O class: "idle", "be:N" (best-effort level N, 0..7), or
+ *           "none" to leave the I/O priority alone; NULL keeps the current one
+ * @return 0 on success, -1 if an argument is invalid
+ */
+extern int setPrio(int nice, char *io);
+
+/**
+ * @brief Lowers the calling process to the background priorities
+ *
+ * Called in the child after fork(), so whatever it runs inherits them.
+ *
+ * @return VOID
+ */
+extern void bgPrio();
+
+/**
+ * @brief Gives a process the shell's own priorities back
+ * @param pid Process moved to the foreground
+ * @return VOID
+ */
+extern void fgPrio(int pid);
+
+/**
+ * @brief Prints the background priorities, as setPrio() takes them
+ * @param f Stream to print to
+ * @return VOID
+ */
+extern void printPrio(FILE *f);
+
+/**
+ * @brief Switches to another session's background priorities
+ * @param state State returned by an earlier swapPrio(), or NULL for a new
+ *              one (the defaults); it is taken over
+ * @return The state that was in use, freed with free()
+ */
+extern void *swapPrio(void *state);
+
+#endif
@@ -0,0 +1,447 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // pipe2(), tee(), splice(), memrchr()
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "Replica.h"
+#include "error.h"
+
+// Most data looked at per tee(): one default pipe's capacity
+#define RELAYSIZE (1 << 16)
+// Most copies of a stage
+#define MAXCOPIES 1024
+
+// A batch of lines dealt to a copy, as the splitter tells the ordered merger
+typedef struct
+{
+  int copy;
+  int lines;
+} Batch;
+
+// Text taken out of a pipe and not written on yet: s[at] to s[len]
+typedef struct
+{
+  char *s;
+  size_t at;
+  size_t len;
+  size_t size;
+} Text;
+
+extern int parseReplica(char *s, int *n, int *spread)
+{
+  if (strncmp(s, "|[", 2))
+    return -1;
+  char *end;
+  long copies = strtol(s + 2, &end, 10);
+  if (copies < 0 || copies > MAXCOPIES)
+    return -1;
+  *spread = 0;
+  for (; *end && *end != ']'; end++)
+    if (*end == 'o')
+      *spread |= REPLICA_ORDER;
+    else if (*end == 'r')
+      *spread |= REPLICA_RR;
+    else
+      return -1;
+  if (*end != ']' || end[1])
+    return -1;
+  if (!copies && (copies = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+    copies = 1;
+  *n = copies;
+  return 0;
+}
+
+// Writes all n bytes of s to fd, -1 if it can't (its reader has gone)
+static int put(int fd, void *s, size_t n)
+{
+  while (n)
+  {
+    ssize_t m = write(fd, s, n);
+    if (m == -1 && errno == EINTR)
+      continue;
+    if (m <= 0)
+      return -1;
+    s = (char *)s + m;
+    n -= m;
+  }
+  return 0;
+}
+
+// Reads exactly n bytes, known to be waiting, from pipe fd
+static int get(int fd, char *s, size_t n)
+{
+  while (n)
+  {
+    ssize_t m = read(fd, s, n);
+    if (m == -1 && errno == EINTR)
+      continue;
+    if (m <= 0)
+      return -1;
+    s += m;
+    n -= m;
+  }
+  return 0;
+}
+
+static void append(Text *t, char *s, size_t n)
+{
+  if (!n)
+    return;
+  if (t->at == t->len)
+    t->at = t->len = 0;
+  if (t->len + n > t->size && t->at)
+  {
+    memmove(t->s, t->s + t->at, t->len - t->at);
+    t->len -= t->at;
+    t->at = 0;
+  }
+  if (t->len + n > t->size)
+  {
+    t->size = (t->len + n) * 2;
+    t->s = realloc(t->s, t->size);
+    if (!t->s)
+      ERROR("realloc() failed");
+  }
+  memcpy(t->s + t->len, s, n);
+  t->len += n;
+}
+
+/**
+ * @brief Looks at what is waiting in pipe fd, without taking it out
+ *
+ * tee() duplicates it into the scratch pipe, which is then read empty.
+ *
+ * @return Bytes looked at (into buf), 0 at end of file, -1 on error (EAGAIN if nonblock and none)
+ */
+static ssize_t peek(int fd, int *scratch, char *buf, int nonblock)
+{
+  ssize_t m;
+  do
+    m = tee(fd, scratch[1], RELAYSIZE, nonblock ? SPLICE_F_NONBLOCK : 0);
+  while (m == -1 && errno == EINTR);
+  if (m > 0 && get(scratch[0], buf, m))
+    return -1;
+  return m;
+}
+
+/**
+ * @brief Moves exactly n bytes from pipe src to dst
+ *
+ * With splice(), unless dst won't take it (a terminal), then through a buffer.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int pass(int src, int dst, size_t n)
+{
+  static char *spare = 0;
+  while (n)
+  {
+    ssize_t m;
+    if (!spare)
+    {
+      m = splice(src, 0, dst, 0, n, SPLICE_F_MOVE);
+      if (m == -1 && errno == EINVAL && !(spare = malloc(RELAYSIZE)))
+        ERROR("malloc() failed");
+    }
+    else
+    {
+      m = read(src, spare, n < RELAYSIZE ? n : RELAYSIZE);
+      if (m > 0 && put(dst, spare, m))
+        return -1;
+    }
+    if (m == -1 && (errno == EINTR || errno == EINVAL))
+      continue;
+    if (m <= 0)
+      return -1;
+    n -= m;
+  }
+  return 0;
+}
+
+// Scratch pipe and buffer for peek()
+static char *scratch(int *fd)
+{
+  signal(SIGPIPE, SIG_IGN); // gone readers show up as EPIPE
+  if (pipe2(fd, O_CLOEXEC) == -1)
+    ERROR("pipe2() failed");
+  char *buf = malloc(RELAYSIZE);
+  if (!buf)
+    ERROR("malloc() failed");
+  return buf;
+}
+
+// Picks the copy for the next batch: the next one round, or the one with least input waiting
+static int pick(int *to, int n, int spread, int *next)
+{
+  int k = -1, least = INT_MAX;
+  for (int j = 0; j < n; j++)
+  {
+    int c = (*next + j) % n, q = 0;
+    if (to[c] == -1)
+      continue;
+    if (spread & REPLICA_RR)
+    {
+      k = c;
+      break;
+    }
+    ioctl(to[c], FIONREAD, &q);
+    if (q < least)
+    {
+      least = q;
+      k = c;
+      if (!q)
+        break;
+    }
+  }
+  if (k != -1)
+    *next = (k + 1) % n;
+  return k;
+}
+
+/**
+ * The lines waiting in the input are looked at once, then dealt out in
+ * even batches across the copies still there, each batch spliced whole.
+ * The start of a line whose end hasn't been written yet is taken out
+ * and goes ahead of the rest of its line, to the same copy. Input that
+ * isn't a pipe (a < file) can't be looked into, it is read and written.
+ */
+extern void splitReplica(int in, int *to, int n, int spread, int order)
+{
+  int fd[2];
+  char *buf = scratch(fd);
+  Text part = {0, 0, 0, 0};
+  int next = 0, live = n;
+  struct stat st;
+  int piped = fstat(in, &st) == 0 && S_ISFIFO(st.st_mode);
+  for (;;)
+  {
+    ssize_t m;
+    if (piped)
+      m = peek(in, fd, buf, 0);
+    else
+      while ((m = read(in, buf, RELAYSIZE)) == -1 && errno == EINTR)
+        ;
+    if (m <= 0)
+      break;
+    int lines = 0;
+    size_t cut = 0;
+    for (char *e = buf; (e = memchr(e, '\n', buf + m - e)); e++, lines++)
+      cut = e - buf + 1;
+    if (!cut)
+    {
+      if (piped && get(in, buf, m))
+        break;
+      append(&part, buf, m);
+      continue;
+    }
+    int per = (lines + live - 1) / live;
+    for (char *s = buf; s < buf + cut;)
+    {
+      int b = 0;
+      size_t len = 0;
+      while (b < per && s + len < buf + cut)
+      {
+        len = (char *)memchr(s + len, '\n', buf + cut - s - len) - s + 1;
+        b++;
+      }
+      int k = pick(to, n, spread, &next);
+      if (k == -1)
+        goto done; // every copy has gone
+      if ((part.len && put(to[k], part.s, part.len)) ||
+          (piped ? pass(in, to[k], len) : put(to[k], s, len)))
+      {
+        // Gone: the rest is looked at again, or dealt again
+        close(to[k]);
+        to[k] = -1;
+        part.len = 0;
+        if (!--live || piped)
+          break;
+        continue;
+      }
+      part.len = 0;
+      Batch batch = {k, b};
+      if (order != -1 && put(order, &batch, sizeof(batch)))
+        order = -1;
+      s += len;
+    }
+    if (!live)
+      goto done;
+    if (!piped)
+      append(&part, buf + cut, m - cut);
+  }
+  // A last line without its end
+  if (part.len)
+  {
+    int k = pick(to, n, spread, &next);
+    Batch batch = {k, 1};
+    if (k != -1 && !put(to[k], part.s, part.len) && order != -1)
+      put(order, &batch, sizeof(batch));
+  }
+done:
+  free(part.s);
+  free(buf);
+}
+
+// Unordered: whole lines are spliced on from whichever copy has them
+static void unordered(int *from, int n, int out, int *fd, char *buf)
+{
+  struct pollfd *fds = calloc(n, sizeof(*fds));
+  Text *part = calloc(n, sizeof(*part));
+  if (!fds || !part)
+    ERROR("calloc() failed");
+  for (int j = 0; j < n; j++)
+  {
+    fds[j].fd = from[j];
+    fds[j].events = POLLIN;
+  }
+  int open = n;
+  while (open)
+  {
+    if (poll(fds, n, -1) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    for (int j = 0; j < n; j++)
+    {
+      if (fds[j].fd == -1 || !fds[j].revents)
+        continue;
+      Text *t = &part[j];
+      ssize_t m = peek(from[j], fd, buf, 1);
+      if (m == -1 && errno == EAGAIN)
+        continue;
+      if (m <= 0)
+      {
+        // The copy has ended, its last line may have no end
+        if (t->len && put(out, t->s, t->len))
+          goto done;
+        close(from[j]);
+        fds[j].fd = -1;
+        open--;
+        continue;
+      }
+      char *e = memrchr(buf, '\n', m);
+      if (!e)
+      {
+        if (get(from[j], buf, m))
+          goto done;
+        append(t, buf, m);
+        continue;
+      }
+      if (t->len && put(out, t->s, t->len))
+        goto done;
+      t->len = 0;
+      if (pass(from[j], out, e - buf + 1))
+        goto done;
+    }
+  }
+done:
+  for (int j = 0; j < n; j++)
+    free(part[j].s);
+  free(part);
+  free(fds);
+}
+
+// Ordered: each copy's output is held until the batches dealt before its own are written
+static void ordered(int *from, int n, int out, int order, char *buf)
+{
+  struct pollfd *fds = calloc(n + 1, sizeof(*fds));
+  Text *held = calloc(n, sizeof(*held));
+  Text batches = {0, 0, 0, 0};
+  if (!fds || !held)
+    ERROR("calloc() failed");
+  for (int j = 0; j < n; j++)
+  {
+    fds[j].fd = from[j];
+    fds[j].events = POLLIN;
+  }
+  fds[n].fd = order;
+  fds[n].events = POLLIN;
+  int open = n + 1;
+  for (;;)
+  {
+    // Write what can be, in the order the batches were dealt
+    while (batches.len - batches.at >= sizeof(Batch))
+    {
+      Batch b;
+      memcpy(&b, batches.s + batches.at, sizeof(b));
+      Text *t = &held[b.copy];
+      char *s = t->s + t->at, *e;
+      size_t avail = t->len - t->at, len = 0;
+      while (b.lines && len < avail && (e = memchr(s + len, '\n', avail - len)))
+      {
+        len = e - s + 1;
+        b.lines--;
+      }
+      if (b.lines && fds[b.copy].fd == -1)
+      {
+        // The copy has ended: the batch is all it gave
+        len = avail;
+        b.lines = 0;
+      }
+      if (len && put(out, s, len))
+        goto done;
+      t->at += len;
+      memcpy(batches.s + batches.at, &b, sizeof(b));
+      if (b.lines)
+        break;
+      batches.at += sizeof(Batch);
+    }
+    if (!open)
+      break;
+    if (poll(fds, n + 1, -1) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    for (int j = 0; j <= n; j++)
+    {
+      if (fds[j].fd == -1 || !fds[j].revents)
+        continue;
+      ssize_t m = read(fds[j].fd, buf, RELAYSIZE);
+      if (m == -1 && errno == EINTR)
+        continue;
+      if (m <= 0)
+      {
+        close(fds[j].fd);
+        fds[j].fd = -1;
+        open--;
+        continue;
+      }
+      append(j < n ? &held[j] : &batches, buf, m);
+    }
+  }
+  // Output no batch accounts for
+  for (int j = 0; j < n; j++)
+    if (held[j].len > held[j].at && put(out, held[j].s + held[j].at, held[j].len - held[j].at))
+      break;
+done:
+  for (int j = 0; j < n; j++)
+    free(held[j].s);
+  free(held);
+  free(batches.s);
+  free(fds);
+}
+
+extern void mergeReplica(int *from, int n, int out, int order)
+{
+  int fd[2];
+  char *buf = scratch(fd);
+  if (order == -1)
+    unordered(from, n, out, fd, buf);
+  else
+    ordered(from, n, out, order, buf);
+  free(buf);
+}
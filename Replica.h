@@ -0,0 +1,69 @@
+#ifndef REPLICA_H
+#define REPLICA_H
+
+/**
+ * Replicated stages: command |[N] command
+ *
+ *   producer |[8] filter | consumer     8 copies of filter
+ *   producer |[0o] filter | consumer    one copy per CPU, output in input order
+ *
+ * The stage after |[N] runs as N copies (N of 0 or none: one per online
+ * CPU), each on a stage, and so a CPU, of its own. A splitter process
+ * reads the stage's input and deals it out to the copies in whole
+ * lines, a batch of them at a time, and a merger process writes their
+ * output on in whole lines, so a line is never torn between copies.
+ *
+ * Flags after N:
+ *
+ *   r   deal round-robin; otherwise each batch goes to the copy with the
+ *       least input still waiting to be read
+ *   o   write the output in input order; otherwise as the copies give it.
+ *       Needs a stage that writes one line for each line it reads (a
+ *       filter that drops lines must run unordered), and holds back the
+ *       output of copies that get ahead, in memory
+ *
+ * Lines move between pipes with tee() and splice() and are looked at,
+ * not copied through, in the splitter and in the unordered merger. The
+ * ordered merger reads the copies' output into buffers of its own. When
+ * every copy has gone (their consumer has), the splitter stops reading,
+ * so the producer sees its pipe close as usual.
+ */
+
+// Flags of |[N]
+enum
+{
+  REPLICA_ORDER = 1, // o: output in input order
+  REPLICA_RR = 2     // r: round-robin
+};
+
+/**
+ * @brief Parses a |[N] operator
+ * @param s Token, |[ N flags ]
+ * @param n Set to the number of copies
+ * @param spread Set to the flags, REPLICA_*
+ * @return 0, or -1 if s isn't one
+ */
+extern int parseReplica(char *s, int *n, int *spread);
+
+/**
+ * @brief Deals the lines read from pipe in out to the copies; runs in a forked relay
+ * @param in Read end of the stage's input
+ * @param to Write ends of the copies' inputs (closed as copies go)
+ * @param n Number of copies
+ * @param spread Flags, REPLICA_*
+ * @param order Write end of a pipe to the ordered merger, or -1
+ * @return VOID
+ */
+extern void splitReplica(int in, int *to, int n, int spread, int order);
+
+/**
+ * @brief Writes the lines the copies give out to the stage's output; runs in a forked relay
+ * @param from Read ends of the copies' outputs
+ * @param n Number of copies
+ * @param out Stage's output
+ * @param order Read end of the pipe from the splitter for output in input order, or -1
+ * @return VOID
+ */
+extern void mergeReplica(int *from, int n, int out, int order);
+
+#endif
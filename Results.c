@@ -0,0 +1,325 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // open_memstream()
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "Results.h"
+#include "error.h"
+
+// Records kept before a write, unless a line ends first
+#define BUFSIZE (1 << 16)
+
+// One stage of a pipeline's record
+typedef struct
+{
+  char *argv; // as JSON
+  int pid;
+  int done;   // wait4() has given the rest
+  int status;
+  struct rusage ru;
+} Stage;
+
+// Record of a pipeline being run
+typedef struct Record
+{
+  int bg;
+  struct timespec start;
+  Stage *stages;
+  int n;
+  int size;
+  struct Record *outer; // pipeline this one runs inside, or 0
+} *Record;
+
+static int fd = -1;
+static int line = 0;
+static Record current = 0;
+static char buf[BUFSIZE];
+static size_t len = 0;
+// Background processes whose reaping is still to be reported
+static int *bgpids = 0;
+static int nbg = 0;
+
+extern void flushResults()
+{
+  size_t done = 0;
+  while (done < len)
+  {
+    ssize_t r = write(fd, buf + done, len - done);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      break;
+    done += r;
+  }
+  len = 0;
+}
+
+// Adds a record to the buffer
+static void emit(char *s, size_t n)
+{
+  if (len + n > BUFSIZE)
+    flushResults();
+  if (n > BUFSIZE)
+  {
+    while (n)
+    {
+      ssize_t r = write(fd, s, n);
+      if (r == -1 && errno == EINTR)
+        continue;
+      if (r <= 0)
+        return;
+      s += r;
+      n -= r;
+    }
+    return;
+  }
+  memcpy(buf + len, s, n);
+  len += n;
+}
+
+// A forked child's records are its own: the buffered ones are the parent's to write
+static void child()
+{
+  len = 0;
+  current = 0;
+  nbg = 0;
+}
+
+extern void openResults(int n)
+{
+  if (fcntl(n, F_SETFD, FD_CLOEXEC) == -1)
+    ERROR("bad --results-fd");
+  fd = n;
+  pthread_atfork(0, 0, child);
+  atexit(flushResults);
+}
+
+extern int onResults()
+{
+  return fd != -1;
+}
+
+extern void lineResults()
+{
+  line++;
+}
+
+/**
+ * @brief Writes a string as JSON, quoted and escaped
+ */
+static void quote(FILE *f, char *s)
+{
+  fputc('"', f);
+  for (; *s; s++)
+  {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\')
+      fprintf(f, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(f, "\\u%04x", c);
+    else
+      fputc(c, f);
+  }
+  fputc('"', f);
+}
+
+static double seconds(struct timeval t)
+{
+  return t.tv_sec + t.tv_usec / 1e6;
+}
+
+// How a process ended, and what it used
+static void usage(FILE *f, int status, struct rusage *ru)
+{
+  if (WIFSIGNALED(status))
+    fprintf(f, "\"status\":null,\"signal\":%d", WTERMSIG(status));
+  else
+    fprintf(f, "\"status\":%d,\"signal\":0", WEXITSTATUS(status));
+  fprintf(f, ",\"user\":%.6f,\"sys\":%.6f,\"maxrss\":%ld", seconds(ru->ru_utime),
+          seconds(ru->ru_stime), ru->ru_maxrss);
+}
+
+extern void startResults(int bg)
+{
+  if (fd == -1)
+    return;
+  Record r = calloc(1, sizeof(*r));
+  if (!r)
+    ERROR("calloc() failed");
+  r->bg = bg;
+  clock_gettime(CLOCK_MONOTONIC, &r->start);
+  r->outer = current;
+  current = r;
+}
+
+extern void stageResults(char **argv, int pid)
+{
+  Record r = current;
+  if (!r)
+    return;
+  if (r->n == r->size)
+  {
+    r->size = r->size ? r->size * 2 : 4;
+    r->stages = realloc(r->stages, sizeof(Stage) * r->size);
+    if (!r->stages)
+      ERROR("realloc() failed");
+  }
+  Stage *s = &r->stages[r->n++];
+  memset(s, 0, sizeof(*s));
+  s->pid = pid;
+  size_t n;
+  FILE *f = open_memstream(&s->argv, &n);
+  if (!f)
+    ERROR("open_memstream() failed");
+  if (!argv)
+    fputs("null", f);
+  else
+  {
+    fputc('[', f);
+    for (char **a = argv; *a; a++)
+    {
+      if (a != argv)
+        fputc(',', f);
+      quote(f, *a);
+    }
+    fputc(']', f);
+  }
+  fclose(f);
+  if (r->bg && pid)
+  {
+    bgpids = realloc(bgpids, sizeof(int) * (nbg + 1));
+    if (!bgpids)
+      ERROR("realloc() failed");
+    bgpids[nbg++] = pid;
+  }
+}
+
+extern void exitResults(int pid, int status, struct rusage *ru)
+{
+  if (fd == -1)
+    return;
+  // A stage of a pipeline being run (or one it runs inside)
+  for (Record r = current; r; r = r->outer)
+    for (int i = 0; i < r->n; i++)
+      if (r->stages[i].pid == pid && !r->stages[i].done)
+      {
+        r->stages[i].done = 1;
+        r->stages[i].status = status;
+        r->stages[i].ru = *ru;
+        return;
+      }
+  // A background process, reported on its own
+  for (int i = 0; i < nbg; i++)
+    if (bgpids[i] == pid)
+    {
+      bgpids[i] = bgpids[--nbg];
+      char *s;
+      size_t n;
+      FILE *f = open_memstream(&s, &n);
+      if (!f)
+        ERROR("open_memstream() failed");
+      fprintf(f, "{\"line\":%d,\"reaped\":%d,", line, pid);
+      usage(f, status, ru);
+      fputs("}\n", f);
+      fclose(f);
+      emit(s, n);
+      free(s);
+      return;
+    }
+}
+
+extern void endResults(int status)
+{
+  Record r = current;
+  if (!r)
+    return;
+  current = r->outer;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double wall = (end.tv_sec - r->start.tv_sec) + (end.tv_nsec - r->start.tv_nsec) / 1e9;
+
+  struct rusage total;
+  memset(&total, 0, sizeof(total));
+  for (int i = 0; i < r->n; i++)
+    if (r->stages[i].done)
+    {
+      struct rusage *ru = &r->stages[i].ru;
+      timeradd(&total.ru_utime, &ru->ru_utime, &total.ru_utime);
+      timeradd(&total.ru_stime, &ru->ru_stime, &total.ru_stime);
+      if (ru->ru_maxrss > total.ru_maxrss)
+        total.ru_maxrss = ru->ru_maxrss;
+    }
+
+  char *s;
+  size_t n;
+  FILE *f = open_memstream(&s, &n);
+  if (!f)
+    ERROR("open_memstream() failed");
+  fprintf(f, "{\"line\":%d,", line);
+  if (r->bg)
+    fprintf(f, "\"status\":null,\"background\":true,\"wall\":%.6f,\"stages\":[", wall);
+  else
+    fprintf(f, "\"status\":%d,\"background\":false,\"wall\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"maxrss\":%ld,\"stages\":[",
+            status, wall, seconds(total.ru_utime), seconds(total.ru_stime), total.ru_maxrss);
+  for (int i = 0; i < r->n; i++)
+  {
+    Stage *st = &r->stages[i];
+    fprintf(f, "%s{\"argv\":%s,\"pid\":%d", i ? "," : "", st->argv, st->pid);
+    if (st->done)
+    {
+      fputc(',', f);
+      usage(f, st->status, &st->ru);
+    }
+    else if (!st->pid)
+      fprintf(f, ",\"status\":%d,\"signal\":0,\"user\":0,\"sys\":0,\"maxrss\":0", status);
+    fputc('}', f);
+    free(st->argv);
+  }
+  fputs("]}\n", f);
+  fclose(f);
+  emit(s, n);
+  free(s);
+  free(r->stages);
+  free(r);
+}
+
+// What swapResults() saves of the state above
+typedef struct
+{
+  Record current;
+  int *bgpids;
+  int nbg;
+} *ResultsState;
+
+extern void *swapResults(void *state)
+{
+  ResultsState old = malloc(sizeof(*old));
+  if (!old)
+    ERROR("malloc() failed");
+  old->current = current;
+  old->bgpids = bgpids;
+  old->nbg = nbg;
+  ResultsState s = state;
+  current = s ? s->current : 0;
+  bgpids = s ? s->bgpids : 0;
+  nbg = s ? s->nbg : 0;
+  free(s);
+  return old;
+}
+
+extern void dropResults(void *state)
+{
+  // Between lines, so no record is open
+  ResultsState s = state;
+  free(s->bgpids);
+  free(s);
+}
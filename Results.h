@@ -0,0 +1,106 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <sys/resource.h>
+
+/**
+ * Machine-readable results: shell --results-fd N
+ *
+ * One JSON object per line is written to fd N for every pipeline run,
+ * for a program that drives the shell through stdin to read instead of
+ * scraping its output:
+ *
+ *   {"line":3,"status":1,"background":false,"wall":0.002113,
+ *    "user":0.001024,"sys":0.000512,"maxrss":3456,
+ *    "stages":[{"argv":["grep","x"],"pid":4242,"status":1,"signal":0,
+ *               "user":0.001024,"sys":0.000512,"maxrss":3456}]}
+ *
+ * line counts the input lines from 1. A stage's status is its exit
+ * status, or null if a signal ended it, which is then given; times are
+ * in seconds and maxrss in kilobytes, from the rusage wait4() returns.
+ * A stage run in the shell itself (a builtin) has pid 0, no usage of its
+ * own and the pipeline's status. A background pipeline's record is
+ * written as it starts, without statuses; each of its processes then
+ * gets a record of its own when it is reaped:
+ *
+ *   {"line":5,"reaped":4250,"status":0,"signal":0,"user":...,"sys":...,"maxrss":...}
+ *
+ * Records are buffered and written once per input line (or when the
+ * buffer fills), not once per command. With results on, stages are
+ * expanded by the shell before they are forked, so their argv is known,
+ * and a line's last command is forked rather than exec'd in place.
+ */
+
+/**
+ * @brief Starts writing results
+ * @param fd Descriptor to write them to; it isn't passed on to commands
+ * @return VOID
+ */
+extern void openResults(int fd);
+
+/**
+ * @brief Whether results are being written
+ * @return Non-zero if so
+ */
+extern int onResults();
+
+/**
+ * @brief Counts an input line
+ * @return VOID
+ */
+extern void lineResults();
+
+/**
+ * @brief Starts the record of a pipeline (records of pipelines run inside it nest)
+ * @param bg Non-zero for a background pipeline
+ * @return VOID
+ */
+extern void startResults(int bg);
+
+/**
+ * @brief Adds a stage to the pipeline's record
+ * @param argv Its arguments, or NULL (a group)
+ * @param pid Its process, or 0 if it runs in the shell
+ * @return VOID
+ */
+extern void stageResults(char **argv, int pid);
+
+/**
+ * @brief Records how a process ended, as wait4() gave it
+ * @param pid Process
+ * @param status Status from wait4()
+ * @param ru Resource use from wait4()
+ * @return VOID
+ */
+extern void exitResults(int pid, int status, struct rusage *ru);
+
+/**
+ * @brief Ends the record of a pipeline, adding it to the buffer
+ * @param status Exit status of the pipeline
+ * @return VOID
+ */
+extern void endResults(int status);
+
+/**
+ * @brief Writes out the records buffered
+ * @return VOID
+ */
+extern void flushResults();
+
+/**
+ * @brief Switches to another session's records: the pipelines being run
+ * and the background processes not reaped yet
+ * @param state State returned by an earlier swapResults(), or NULL for a
+ *              new one; it is taken over
+ * @return The state that was in use
+ */
+extern void *swapResults(void *state);
+
+/**
+ * @brief Frees state returned by swapResults()
+ * @param state State to free
+ * @return VOID
+ */
+extern void dropResults(void *state);
+
+#endif
@@ -3,6 +3,8 @@
 #include <string.h>
 
 #include "Scanner.h"
+#define ALLOC_MODULE AL_SCANNER
+#include "Alloc.h"
 #include "error.h"
 
 typedef struct
@@ -15,27 +17,30 @@ typedef struct
   char *pos;
   // Current token
   char *curr;
+  // Parentheses opened by (, <( and >( tokens, and not closed yet
+  int depth;
 } *ScannerRep; // Private: Internal Representation
 
 extern Scanner newScanner(char *s)
 {
-  ScannerRep r = (ScannerRep)malloc(sizeof(*r));
+  // One scanner and its tokens per line: recycled blocks (see Alloc.h)
+  ScannerRep r = (ScannerRep)newAlloc(AL_SCANNER, sizeof(*r));
   if (!r)
     ERROR("malloc() failed");
   r->eos = 0;
-  r->str = strdup(s);
+  r->str = dupAlloc(AL_SCANNER, s, strlen(s));
   r->pos = r->str;
   r->curr = 0;
+  r->depth = 0;
   return r;
 }
 
 extern void freeScanner(Scanner scan)
 {
   ScannerRep r = scan;
-  free(r->str);
-  if (r->curr)
-    free(r->curr);
-  free(r);
+  freedupAlloc(r->str);
+  freedupAlloc(r->curr);
+  freeAlloc(r, sizeof(*r));
 }
 /**
  * Adcances pointer (p) through any characters found in string (q) stops at first character not in q
@@ -73,6 +78,18 @@ extern char *nextScanner(Scanner scan)
   char *new = wsupto(old);
   // Size is equal to the number of tokens in the input string
   int size = new - old;
+  // A process substitution's <( or >( may be glued to its first word
+  if (size > 2 && (old[0] == '<' || old[0] == '>') && old[1] == '(')
+  {
+    new = old + 2;
+    size = 2;
+  }
+  // Inside one, the ) that closes it may be glued to its last word: <(ls)
+  for (int open = r->depth; open && size > 1 && new[-1] == ')'; open--)
+  {
+    new--;
+    size--;
+  }
 
   // Checking if there are tokens
   if (size == 0)
@@ -81,10 +98,9 @@ extern char *nextScanner(Scanner scan)
     return 0;
   }
 
-  if (r->curr)
-    free(r->curr);
+  freedupAlloc(r->curr);
 
-  r->curr = (char *)malloc(size + 1);
+  r->curr = (char *)newAlloc(AL_SCANNER, size + 1);
 
   if (!r->curr)
     ERROR("malloc() failed");
@@ -93,6 +109,10 @@ extern char *nextScanner(Scanner scan)
 
   (r->curr)[size] = 0;
   r->pos = new;
+  if (!strcmp(r->curr, "(") || !strcmp(r->curr, "<(") || !strcmp(r->curr, ">("))
+    r->depth++;
+  else if (!strcmp(r->curr, ")") && r->depth)
+    r->depth--;
   return r->curr;
 }
 
@@ -21,6 +21,11 @@ extern void freeScanner(Scanner scan);
 
 /**
  * @brief Get next token and advances the scanner
+ *
+ * Tokens are split on whitespace, except that a <( or >( glued to the
+ * word after it is a token of its own, and so is a ) glued to the end of
+ * a word while a (, <( or >( is open: cat <(ls) is cat, <(, ls, ).
+ *
  * @param scan Scanner object
  * @return Next token in the string
  */
@@ -17,8 +17,9 @@ extern void freeSequence(Sequence sequence)
   deq_del(sequence, freePipeline);
 }
 
-extern void execSequence(Sequence sequence, Jobs jobs, int *eof)
+extern int execSequence(Sequence sequence, Jobs jobs, int *eof)
 {
+  int status = 0;
   // Continue processing pipelines while:
   //   - The sequence still has pipelines (deq_len(sequence) > 0)
   //   - AND the user hasn't requested to exit (!*eof)
@@ -30,8 +31,18 @@ extern void execSequence(Sequence sequence, Jobs jobs, int *eof)
     //   - Waiting (if foreground) or not waiting (if background)
     //   - Setting up pipes between commands
     //   - Job management
-    execPipeline(deq_head_get(sequence), jobs, eof);
+    //   - Skipping it if && or || says so
+    status = execPipeline(deq_head_get(sequence), jobs, eof, status);
   }
   // Clean up: Free the sequence and any remaining pipelines
   freeSequence(sequence);
+  return status;
+}
+
+extern int runSequence(Sequence sequence, Jobs jobs, int *eof)
+{
+  int status = 0;
+  for (int i = 0; i < deq_len(sequence) && !*eof; i++)
+    status = runPipeline(deq_head_ith(sequence, i), jobs, eof, status);
+  return status;
 }
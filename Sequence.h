@@ -87,11 +87,26 @@ extern void freeSequence(Sequence sequence);
  * @param eof - Pointer to flag indicating if shell should exit
  *              Set to non-zero by 'exit' builtin or EOF
  *
- * @return void
+ * @return Exit status of the last pipeline run (0 if none), which
+ *         also decides whether a pipeline after && or || runs
  *
  * @note This function always frees the sequence before returning
  * @note Foreground vs background execution is handled within execPipeline
  */
-extern void execSequence(Sequence sequence, Jobs jobs, int *eof);
+extern int execSequence(Sequence sequence, Jobs jobs, int *eof);
+
+/**
+ * @brief Runs all pipelines in a sequence in order, keeping them
+ *
+ * Like execSequence(), but the sequence is a plan that may be run again
+ * (a loop body, a { } group): nothing is removed from it or freed.
+ *
+ * @param sequence - The sequence of pipelines to run
+ * @param jobs - Job table for tracking background processes
+ * @param eof - Pointer to flag indicating if shell should exit
+ *
+ * @return Exit status of the last pipeline run (0 if none)
+ */
+extern int runSequence(Sequence sequence, Jobs jobs, int *eof);
 
 #endif
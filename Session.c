@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "Session.h"
+#include "Parser.h"
+#include "Interpreter.h"
+#include "Command.h"
+#include "Jobs.h"
+#include "Vars.h"
+#include "Capture.h"
+#include "Coproc.h"
+#include "Results.h"
+#include "Stats.h"
+#include "Alloc.h"
+#include "Pin.h"
+#include "Prio.h"
+#include "Deadline.h"
+#include "Meter.h"
+#include "error.h"
+
+typedef struct
+{
+  Jobs jobs;
+  // Each module's state while the session isn't running, from its swap function
+  void *vars;
+  void *command;
+  void *parser;
+  void *capture;
+  void *coproc;
+  void *results;
+  void *stats;
+  void *alloc;
+  void *pin;
+  void *prio;
+  long deadline; // default deadline
+  int meter;     // metering on
+  char *rest;    // rest of the lines being run, read a line at a time
+  char *dir;     // working directory when it last stopped running, or 0
+  char *host;    // working directory of the process while it runs
+  int eof;       // exit was run
+} *SessionRep;
+
+// The working directory and stdin/stdout are the process's: one session runs at a time
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Lines of the session running (under lock)
+static char *rest = 0;
+
+// Session whose lines this thread runs
+static __thread SessionRep running = 0;
+
+static char *restLine(const char *prompt)
+{
+  if (!rest || !*rest)
+    return 0;
+  size_t n = strcspn(rest, "\n");
+  char *line = strndup(rest, n);
+  rest += rest[n] ? n + 1 : n;
+  return line;
+}
+
+static void idle(int waiting);
+
+extern ShellSession shell_new_session()
+{
+  SessionRep s = calloc(1, sizeof(*s));
+  if (!s)
+    ERROR("calloc() failed");
+  // Jobs are made of recycled blocks, which are only touched under the lock
+  pthread_mutex_lock(&lock);
+  hostCommand(idle);
+  s->jobs = newJobs();
+  pthread_mutex_unlock(&lock);
+  return s;
+}
+
+/**
+ * @brief Trades the state in use for the session's, both ways
+ */
+static void swap(SessionRep s)
+{
+  s->vars = swapVars(s->vars);
+  s->command = swapCommand(s->command);
+  s->parser = swapParser(s->parser);
+  s->capture = swapCapture(s->capture);
+  s->coproc = swapCoproc(s->coproc);
+  s->results = swapResults(s->results);
+  s->stats = swapStats(s->stats);
+  s->alloc = swapAlloc(s->alloc);
+  s->pin = swapPin(s->pin);
+  s->prio = swapPrio(s->prio);
+  long deadline = getDeadline();
+  setDeadline(s->deadline);
+  s->deadline = deadline;
+  int meter = onMeter();
+  setMeter(s->meter ? "on" : "off");
+  s->meter = meter;
+  char *r = rest;
+  rest = s->rest;
+  s->rest = r;
+}
+
+/**
+ * @brief Makes a session's state the current state, saving what was there
+ */
+static void enter(SessionRep s)
+{
+  s->host = getcwd(0, 0);
+  if (s->dir && chdir(s->dir))
+    ERRORLOC(__FILE__, __LINE__, "error", "%s", "session directory is gone");
+  swap(s);
+}
+
+/**
+ * @brief Puts back the state saved by enter(), keeping the session's
+ */
+static void leave(SessionRep s)
+{
+  swap(s);
+  free(s->dir);
+  s->dir = getcwd(0, 0);
+  if (s->host && chdir(s->host))
+    ERRORLOC(__FILE__, __LINE__, "error", "%s", "can't return to the working directory");
+  free(s->host);
+  s->host = 0;
+}
+
+/**
+ * @brief Lets other sessions run while this thread waits for its children
+ * @param waiting 1 before the wait, 0 after it
+ */
+static void idle(int waiting)
+{
+  SessionRep s = running;
+  if (!s)
+    return;
+  if (waiting)
+  {
+    fflush(stdout);
+    leave(s);
+    pthread_mutex_unlock(&lock);
+  }
+  else
+  {
+    pthread_mutex_lock(&lock);
+    enter(s);
+  }
+}
+
+extern int shell_run_line(ShellSession session, const char *line, int *status)
+{
+  SessionRep s = session;
+  if (status)
+    *status = 0;
+  if (s->eof)
+    return -1;
+  pthread_mutex_lock(&lock);
+  enter(s);
+  running = s;
+
+  char *lines = strdup(line);
+  rest = lines;
+  char *l;
+  while (!s->eof && (l = restLine(0)))
+  {
+    char *more;
+    while (openTree(l) && (more = restLine(0)))
+      l = continueTree(l, more);
+    Tree tree = parseTree(l);
+    free(l);
+    hereTree(tree, restLine);
+    int st = interpretTree(tree, &s->eof, s->jobs, 0);
+    if (tree && status)
+      *status = st;
+    freeTree(tree);
+    reap_background_processes();
+  }
+  rest = 0;
+  free(lines);
+  fflush(stdout);
+
+  running = 0;
+  leave(s);
+  pthread_mutex_unlock(&lock);
+  return s->eof ? -1 : 0;
+}
+
+extern void shell_free_session(ShellSession session)
+{
+  SessionRep s = session;
+  pthread_mutex_lock(&lock);
+  // Wherever its directory went, it isn't needed any more
+  free(s->dir);
+  s->dir = 0;
+  enter(s);
+  running = s;
+  // As exit does, but letting other sessions run meanwhile
+  endCommand();
+  endCapture();
+  freeCoproc();
+  freePin();
+  freeVars();
+  freeJobs(s->jobs);
+  fflush(stdout);
+  running = 0;
+  leave(s);
+  dropCommand(s->command);
+  dropResults(s->results);
+  dropAlloc(s->alloc);
+  free(s->capture);
+  free(s->stats);
+  free(s->pin);
+  free(s->prio);
+  pthread_mutex_unlock(&lock);
+  free(s->dir);
+  free(s);
+}
@@ -0,0 +1,65 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+/**
+ * Embedding API: the shell as a library (libshell.a, libshell.so)
+ *
+ * A session holds what one interactive shell would: variables, jobs,
+ * the working directory and background processes. A program can keep
+ * several sessions and run command lines in each, without starting a
+ * shell process per command:
+ *
+ *   ShellSession s = shell_new_session();
+ *   int status;
+ *   shell_run_line(s, "cd /tmp ; X=1", &status);
+ *   shell_run_line(s, "echo $X > out && ls", &status);
+ *   shell_free_session(s);
+ *
+ * Sessions may be used from different threads. Each keeps its own
+ * settings as well (timeout, capture, meter, pin, bgprio), coprocesses
+ * and allocation counts. The working directory and stdin/stdout belong
+ * to the whole process, so one session runs at a time: a call waits
+ * while another session's line runs, but only until that line waits for
+ * its children, as when it runs sleep, and not while a builtin or group
+ * of it has stdin/stdout redirected. The calling process must not depend
+ * on its working directory changing while a line runs.
+ *
+ * Children forked by a session end with _exit(), so the program's
+ * atexit() handlers and stdio buffers are never run twice, and exec
+ * refuses to replace (or redirect) the program.
+ */
+
+typedef void *ShellSession;
+
+/**
+ * @brief Creates a session
+ *
+ * Its variables start as a copy of the process environment, and its
+ * working directory is the process's.
+ *
+ * @return New session
+ */
+extern ShellSession shell_new_session();
+
+/**
+ * @brief Runs command lines in a session, like lines typed into the shell
+ *
+ * Output goes to the process's stdout. line may hold several lines
+ * separated by newlines, which is also how here-document bodies are
+ * given ("cat <<EOF\nbody\nEOF").
+ *
+ * @param session Session to run in
+ * @param line Command line(s)
+ * @param status Set to the exit status of the last pipeline run (may be NULL)
+ * @return 0, or -1 if the session has ended (exit) and runs nothing more
+ */
+extern int shell_run_line(ShellSession session, const char *line, int *status);
+
+/**
+ * @brief Frees a session, after waiting for its background processes
+ * @param session Session to free
+ * @return VOID
+ */
+extern void shell_free_session(ShellSession session);
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <termios.h>
@@ -9,59 +10,146 @@
 #include "Jobs.h"
 #include "Parser.h"
 #include "Interpreter.h"
+#include "Vars.h"
+#include "Glob.h"
+#include "History.h"
+#include "Pin.h"
+#include "Stats.h"
+#include "Alloc.h"
+#include "Complete.h"
+#include "Capture.h"
+#include "Coproc.h"
+#include "Results.h"
 #include "error.h"
 
-int main()
+// Rest of the -c command string, read a line at a time
+static char *command = 0;
+
+static char *commandLine(const char *prompt)
+{
+  if (!command || !*command)
+    return 0;
+  size_t n = strcspn(command, "\n");
+  char *line = strndup(command, n);
+  command += command[n] ? n + 1 : n;
+  return line;
+}
+
+int main(int argc, char **argv)
 {
   int eof = 0;
+  int status = 0; // of the last pipeline run, the shell's own exit status
   Jobs jobs = newJobs();
   char *prompt = 0;
+  char *(*input)(const char *) = readline;
+
+  // shell --results-fd N ...: a JSON record of every pipeline run goes to fd N
+  if (argc > 2 && !strcmp(argv[1], "--results-fd"))
+  {
+    char *end;
+    long fd = strtol(argv[2], &end, 10);
+    openResults(*end || end == argv[2] ? -1 : fd);
+    argv += 2;
+    argc -= 2;
+  }
+
+  // shell -c command, or shell script: the whole input is known up front
+  int ahead = 0;
+  if (argc > 2 && !strcmp(argv[1], "-c"))
+  {
+    command = argv[2];
+    input = commandLine;
+    ahead = 1;
+  }
+  else if (argc > 1)
+  {
+    rl_instream = fopen(argv[1], "re");
+    if (!rl_instream)
+      ERROR("can't open script");
+    ahead = 1;
+  }
+  int tty = !ahead && isatty(fileno(stdin));
 
-  if (isatty(fileno(stdin)))
+  // kill -USR1 prints the stats, without disturbing what is running
+  signalStats();
+
+  if (tty)
   {
     using_history();
 
-    // MIGHT NEED TO CHANGE BACK
-    read_history(".history");
-    // clear_history();
+    // Append-only log with an index, only the tail is loaded
+    openHistory(".history");
     prompt = "$ ";
+    // Commands from PATH, files through the glob directory cache
+    initComplete();
   }
   else
   {
+    // Scripts keep their history in memory
+    openHistory(0);
     rl_bind_key('\t', rl_insert);
     rl_outstream = fopen("/dev/null", "w");
   }
 
+  // Reading a line ahead tells us when a line is the last, whose final
+  // command can then replace the shell rather than fork and be waited for
+  char *next = ahead ? input(prompt) : 0;
   while (!eof)
   {
     // Getting line after $ prompt will be command string to parse and execute
-    char *line = readline(prompt);
+    char *line = ahead ? next : input(prompt);
     if (!line)
       break;
     if (*line)
     {
       // printf("DEBUG LINE => %s\n", line);
       // Adding line to history
-      add_history(line);
+      addHistory(line);
+    }
+    // An if, while or for left open goes on in the next lines
+    while (openTree(line))
+    {
+      char *more = ahead ? next : input(tty ? "> " : prompt);
+      if (!more)
+        break;
+      if (*more)
+        addHistory(more);
+      line = continueTree(line, more);
+      if (ahead)
+        next = input(prompt);
     }
     // Passing in line to be parsed
     Tree tree = parseTree(line);
+    // Here-document bodies follow the command line
+    hereTree(tree, input);
 
     // Freeing line after bing parsed
     free(line);
+    if (ahead)
+      next = input(prompt);
     // After parse tree has been built from input command string. Intrepret the tree
 
     //* This envolves actually executing the input command
-    interpretTree(tree, &eof, jobs);
+    int st = interpretTree(tree, &eof, jobs, ahead && !next);
+    if (tree)
+      status = st;
 
     // Last step to clean up and free the Parse Tree allocated
     freeTree(tree);
     reap_background_processes();
+    // Whoever reads the records may be waiting on them to send the next line
+    flushResults();
   }
 
-  if (isatty(fileno(stdin)))
+  // A line read ahead of an exit is never run
+  free(next);
+
+  // Every line was appended as it was read, nothing to write back
+  closeHistory();
+  if (rl_instream && rl_instream != stdin)
+    fclose(rl_instream);
+  if (tty)
   {
-    write_history(".history");
     rl_clear_history();
   }
   else
@@ -69,6 +157,13 @@ int main()
     fclose(rl_outstream);
   }
   freestateCommand();
+  freeVars();
+  freeComplete();
+  freeCapture();
+  freeCoproc();
+  freeGlob();
+  freePin();
   freeJobs(jobs);
-  return 0;
+  freestateAlloc();
+  return status;
 }
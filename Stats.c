@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "Stats.h"
+#include "History.h"
+#include "error.h"
+
+// Histogram buckets: values below SUB exactly, then SUB per power of two up to 2^MAXEXP ns
+#define SUB 16
+#define SUBBITS 4
+#define MAXEXP 47
+#define BUCKETS ((MAXEXP - SUBBITS + 2) * SUB)
+
+typedef struct
+{
+  unsigned long count;
+  unsigned long min; // 0 until the first value
+  unsigned long max;
+  unsigned long bucket[BUCKETS];
+} Hist;
+
+// Shared with every child forked, so it sees (and adds to) the same counts
+typedef struct
+{
+  unsigned long counter[ST_COUNTERS];
+  Hist hist[ST_HISTS];
+} *StatsRep;
+
+static StatsRep stats = 0;
+
+// Parent-only: when the current line began (0 once it has forked), and when each child was forked
+static long linestart = 0;
+#define SPAWNED 256
+typedef struct
+{
+  int pid;
+  long start;
+} Spawned;
+static Spawned spawned[SPAWNED];
+
+static StatsRep shared()
+{
+  if (!stats)
+  {
+    stats = mmap(0, sizeof(*stats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED)
+      ERROR("mmap() failed");
+  }
+  return stats;
+}
+
+#define ADD(x, n) __atomic_fetch_add(&(x), (n), __ATOMIC_RELAXED)
+#define GET(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+extern void countStats(int counter)
+{
+  ADD(shared()->counter[counter], 1);
+}
+
+extern long nowStats()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int bucket(unsigned long v)
+{
+  if (v < SUB)
+    return v;
+  int e = 63 - __builtin_clzl(v);
+  if (e > MAXEXP)
+    return BUCKETS - 1;
+  return (e - SUBBITS + 1) * SUB + ((v >> (e - SUBBITS)) & (SUB - 1));
+}
+
+// Largest value that goes in bucket i
+static unsigned long highest(int i)
+{
+  if (i < SUB)
+    return i;
+  int e = i / SUB + SUBBITS - 1;
+  unsigned long low = (unsigned long)(SUB + i % SUB) << (e - SUBBITS);
+  return low + (1UL << (e - SUBBITS)) - 1;
+}
+
+extern void timeStats(int hist, long start)
+{
+  unsigned long v = nowStats() - start;
+  Hist *h = &shared()->hist[hist];
+  ADD(h->bucket[bucket(v)], 1);
+  ADD(h->count, 1);
+  // Lock-free min/max: retry only while another process moved them the wrong way
+  unsigned long m = GET(h->max);
+  while (v > m && !__atomic_compare_exchange_n(&h->max, &m, v, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  m = GET(h->min);
+  while ((!m || v < m) && !__atomic_compare_exchange_n(&h->min, &m, v ? v : 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+extern void lineStats(long start)
+{
+  linestart = start;
+}
+
+extern void forkStats(int pid)
+{
+  countStats(ST_FORKS);
+  long now = nowStats();
+  if (linestart)
+  {
+    timeStats(ST_SPAWN, linestart);
+    linestart = 0;
+  }
+  // A slot still in use belongs to a process never reaped by waiting, its sample is lost
+  spawned[pid % SPAWNED].pid = pid;
+  spawned[pid % SPAWNED].start = now;
+}
+
+extern void exitStats(int pid)
+{
+  if (spawned[pid % SPAWNED].pid != pid)
+    return;
+  spawned[pid % SPAWNED].pid = 0;
+  timeStats(ST_EXIT, spawned[pid % SPAWNED].start);
+}
+
+// What swapStats() saves of the parent-only state above
+typedef struct
+{
+  long linestart;
+  Spawned spawned[SPAWNED];
+} *StatsState;
+
+extern void *swapStats(void *state)
+{
+  StatsState old = malloc(sizeof(*old));
+  if (!old)
+    ERROR("malloc() failed");
+  old->linestart = linestart;
+  memcpy(old->spawned, spawned, sizeof(spawned));
+  StatsState s = state;
+  linestart = s ? s->linestart : 0;
+  if (s)
+    memcpy(spawned, s->spawned, sizeof(spawned));
+  else
+    memset(spawned, 0, sizeof(spawned));
+  free(s);
+  return old;
+}
+
+// Output is formatted by hand into a buffer, printf() isn't safe in a signal handler
+typedef struct
+{
+  char s[2048];
+  int n;
+} Buf;
+
+static void put(Buf *b, const char *s)
+{
+  for (; *s && b->n < (int)sizeof(b->s); s++)
+    b->s[b->n++] = *s;
+}
+
+// Right-aligns s in a field of width w
+static void field(Buf *b, const char *s, int w)
+{
+  for (int pad = w - (int)strlen(s); pad > 0; pad--)
+    put(b, " ");
+  put(b, s);
+}
+
+static char *decimal(char *end, unsigned long v)
+{
+  *--end = 0;
+  do
+    *--end = '0' + v % 10;
+  while (v /= 10);
+  return end;
+}
+
+static void number(Buf *b, unsigned long v, int w)
+{
+  char s[24];
+  field(b, decimal(s + sizeof(s), v), w);
+}
+
+// ns as 123ns, 4.5us, 67.8ms or 9.0s
+static void duration(Buf *b, unsigned long ns, int w)
+{
+  static const struct
+  {
+    unsigned long div;
+    const char *unit;
+  } units[] = {{1, "ns"}, {1000, "us"}, {1000000, "ms"}, {1000000000, "s"}};
+  int u = 0;
+  while (u < 3 && ns >= units[u + 1].div)
+    u++;
+  char s[32], *p = s + 20;
+  p = decimal(p, ns / units[u].div);
+  char *q = p + strlen(p);
+  if (u)
+  {
+    *q++ = '.';
+    *q++ = '0' + ns % units[u].div * 10 / units[u].div;
+  }
+  strcpy(q, units[u].unit);
+  field(b, p, w);
+}
+
+// A label and its count, lined up in columns
+#define LABEL 24
+
+static void row(Buf *b, const char *label, unsigned long v)
+{
+  put(b, label);
+  number(b, v, LABEL - strlen(label));
+  put(b, "\n");
+}
+
+// Smallest bucket value at or above which pct percent of the values lie
+static unsigned long percentile(Hist *h, unsigned long count, int pct)
+{
+  unsigned long want = (count * pct + 99) / 100, seen = 0;
+  for (int i = 0; i < BUCKETS; i++)
+    if ((seen += GET(h->bucket[i])) >= want)
+    {
+      unsigned long v = highest(i), max = GET(h->max);
+      return v < max ? v : max;
+    }
+  return GET(h->max);
+}
+
+extern void printStats(int fd)
+{
+  static const char *counters[] = {
+      "lines parsed", "forks", "exec failures", "builtins in-process", "pipes"};
+  static const char *hists[] = {"parse", "line-to-spawn", "spawn-to-exit"};
+  StatsRep s = shared();
+  Buf b;
+  b.n = 0;
+
+  for (int i = 0; i < ST_BGSTART; i++)
+    row(&b, counters[i], GET(s->counter[i]));
+  unsigned long reaped = GET(s->counter[ST_BGREAPED]);
+  row(&b, "jobs live", GET(s->counter[ST_BGSTART]) - reaped);
+  row(&b, "jobs reaped", reaped);
+  row(&b, "history", sizeHistory());
+
+  put(&b, "latency            count     min     p50     p90     p99     max\n");
+  for (int i = 0; i < ST_HISTS; i++)
+  {
+    Hist *h = &s->hist[i];
+    unsigned long count = GET(h->count);
+    put(&b, hists[i]);
+    number(&b, count, LABEL - strlen(hists[i]));
+    if (count)
+    {
+      duration(&b, GET(h->min), 8);
+      duration(&b, percentile(h, count, 50), 8);
+      duration(&b, percentile(h, count, 90), 8);
+      duration(&b, percentile(h, count, 99), 8);
+      duration(&b, GET(h->max), 8);
+    }
+    put(&b, "\n");
+  }
+
+  for (int n = 0, w; n < b.n; n += w)
+    if ((w = write(fd, b.s + n, b.n - n)) <= 0)
+      break;
+}
+
+static void dump(int sig)
+{
+  int e = errno;
+  printStats(STDERR_FILENO);
+  errno = e;
+}
+
+extern void signalStats()
+{
+  shared();
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = dump;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR1, &sa, 0);
+}
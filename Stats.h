@@ -0,0 +1,115 @@
+#ifndef STATS_H
+#define STATS_H
+
+/**
+ * Counters and latency histograms of the shell's own work
+ *
+ * Always on: each event is one relaxed atomic add, with no lock and no
+ * system call besides reading the monotonic clock for timed events. The
+ * counters live in a shared anonymous mapping, so events that happen in
+ * a forked child (an exec that fails) are counted too.
+ *
+ * Latencies go into HDR-style histograms: log-linear buckets, 16 per
+ * power of two, so any value is kept to within about 6% from
+ * nanoseconds up to hours, in a fixed amount of memory.
+ *
+ * The stats builtin prints them, and so does SIGUSR1 (to stderr), which
+ * is safe to send at any time.
+ */
+
+// Events counted
+enum
+{
+  ST_LINES,    // command lines parsed
+  ST_FORKS,    // processes forked
+  ST_EXECFAIL, // execs that failed
+  ST_BUILTINS, // builtins run in the shell process
+  ST_PIPES,    // pipes created
+  ST_BGSTART,  // background processes started
+  ST_BGREAPED, // background processes reaped
+  ST_COUNTERS
+};
+
+// Latencies measured
+enum
+{
+  ST_PARSE, // parsing a line
+  ST_SPAWN, // start of a line to its first fork
+  ST_EXIT,  // fork to the process being reaped (in the background, when next checked)
+  ST_HISTS
+};
+
+/**
+ * @brief Counts an event
+ * @param counter ST_LINES ... ST_BGREAPED
+ * @return VOID
+ */
+extern void countStats(int counter);
+
+/**
+ * @brief Reads the monotonic clock
+ * @return Nanoseconds, from an arbitrary start
+ */
+extern long nowStats();
+
+/**
+ * @brief Records a latency
+ * @param hist ST_PARSE, ST_SPAWN or ST_EXIT
+ * @param start nowStats() when the timed work began
+ * @return VOID
+ */
+extern void timeStats(int hist, long start);
+
+/**
+ * @brief Marks the start of a command line, for the line-to-spawn latency
+ * @param start nowStats() when the line began
+ * @return VOID
+ */
+extern void lineStats(long start);
+
+/**
+ * @brief Counts a fork, in the parent
+ *
+ * The first fork of a line records the line-to-spawn latency, and the
+ * time is kept so the reaping of pid records spawn-to-exit.
+ *
+ * @param pid Child forked
+ * @return VOID
+ */
+extern void forkStats(int pid);
+
+/**
+ * @brief Records the spawn-to-exit latency of a child that was reaped
+ * @param pid Child reaped
+ * @return VOID
+ */
+extern void exitStats(int pid);
+
+/**
+ * @brief Switches to another session's line and children, for the latencies
+ *
+ * The counters and histograms are the process's, shared by every session.
+ *
+ * @param state State returned by an earlier swapStats(), or NULL for a
+ *              new one; it is taken over
+ * @return The state that was in use, freed with free()
+ */
+extern void *swapStats(void *state);
+
+/**
+ * @brief Prints the counters and histograms
+ *
+ * Only uses write(), so it can be called from a signal handler.
+ *
+ * @param fd File descriptor to write to
+ * @return VOID
+ */
+extern void printStats(int fd);
+
+/**
+ * @brief Makes SIGUSR1 print the stats to stderr
+ * @return VOID
+ */
+extern void signalStats();
+
+#endif
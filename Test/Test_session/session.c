@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "Session.h"
+
+// Run once, by this program's exit: not by the shell's children
+static void bye()
+{
+  printf("bye\n");
+}
+
+// A line that waits for a child, in a thread of its own
+static void *slow(void *session)
+{
+  shell_run_line(session, "/bin/sleep 0.5 ; echo a done", 0);
+  return 0;
+}
+
+// Two sessions run alternately, each keeping its own variables and directory
+int main()
+{
+  ShellSession a = shell_new_session();
+  ShellSession b = shell_new_session();
+  int status;
+  shell_run_line(a, "X=a ; cd Test", &status);
+  shell_run_line(b, "X=b", &status);
+  shell_run_line(a, "echo $X ; ls -d ../Test", &status);
+  shell_run_line(b, "echo $X ; ls -d Test", &status);
+  shell_run_line(a, "ls -d ../Test | cat && false", &status);
+  printf("status %d\n", status);
+  shell_run_line(b, "cat <<END\nhere\nEND\necho two lines", &status);
+  printf("exit %d\n", shell_run_line(b, "exit", &status));
+  printf("after exit %d\n", shell_run_line(b, "echo not run", &status));
+  shell_free_session(b);
+
+  // Settings are the session's, the program can't be replaced, and a
+  // session waiting for its children lets another one run
+  atexit(bye);
+  ShellSession c = shell_new_session();
+  shell_run_line(a, "timeout 5 ; ( echo subshell ) ; exec /bin/echo replaced", &status);
+  printf("exec %d\n", status);
+  shell_run_line(c, "timeout", &status);
+  pthread_t t;
+  pthread_create(&t, 0, slow, a);
+  usleep(100000);
+  shell_run_line(c, "echo c ; timeout", &status);
+  pthread_join(t, 0);
+  shell_free_session(a);
+  shell_free_session(c);
+  return 0;
+}
@@ -3,13 +3,17 @@
 #include <string.h>
 
 #include "Tree.h"
+#define ALLOC_MODULE AL_TREE
+#include "Alloc.h"
 #include "error.h"
 
-#define ALLOC(t)              \
-  t v = malloc(sizeof(*v));   \
-  if (!v)                     \
-    ERROR("malloc() failed"); \
+// Nodes are made and freed for every line, so they are recycled (see Alloc.h)
+#define ALLOC(t)                         \
+  t v = newAlloc(AL_TREE, sizeof(*v));   \
+  if (!v)                                \
+    ERROR("malloc() failed");            \
   return memset(v, 0, sizeof(*v));
+#define FREE(t) freeAlloc(t, sizeof(*t));
 
 extern T_sequence new_sequence() { ALLOC(T_sequence) }
 extern T_pipeline new_pipeline() { ALLOC(T_pipeline) }
@@ -17,3 +21,12 @@ extern T_command new_command() { ALLOC(T_command) }
 extern T_words new_words() { ALLOC(T_words) }
 extern T_word new_word() { ALLOC(T_word) }
 extern T_redir new_redir() { ALLOC(T_redir) }
+extern T_control new_control() { ALLOC(T_control) }
+
+extern void del_sequence(T_sequence t) { FREE(t) }
+extern void del_pipeline(T_pipeline t) { FREE(t) }
+extern void del_command(T_command t) { FREE(t) }
+extern void del_words(T_words t) { FREE(t) }
+extern void del_word(T_word t) { FREE(t) }
+extern void del_redir(T_redir t) { FREE(t) }
+extern void del_control(T_control t) { FREE(t) }
@@ -16,17 +16,22 @@ typedef struct T_words *T_words;
 typedef struct T_word *T_word;
 // New struct to handle redirects
 typedef struct T_redir *T_redir;
+typedef struct T_control *T_control;
 
 struct T_redir
 {
   char *input;
   char *output;
+  char *delim; /* <<word: here-document delimiter */
+  char *here;  /* here-document or <<<word here-string body */
+  int dupin;   /* <&N: input is descriptor N, not a file */
+  int dupout;  /* >&N: output is descriptor N, not a file */
 };
 
 struct T_sequence
 {
   T_pipeline pipeline;
-  char *op; /* ; or & */
+  char *op; /* ; & && or || */
   T_sequence sequence;
 };
 
@@ -34,14 +39,31 @@ struct T_pipeline
 {
   T_command command;
   T_pipeline pipeline;
+  T_sequence tee; /* |& { pipeline ; pipeline } fan-out branches */
+  long timeout;   /* timeout DURATION before the pipeline, in ms, or 0 */
+  int copies;     /* |[N] before the command: copies of it to run, or 0 */
+  int spread;     /* |[N] flags, REPLICA_* (Replica.h) */
 };
 
 struct T_command
 {
   T_words words;
+  T_sequence group;  /* { sequence } or ( sequence ), instead of words */
+  int subshell;      /* group is ( sequence ) */
+  T_control control; /* if, while or for, instead of words */
   T_redir redir;
 };
 
+struct T_control
+{
+  char *kind;       /* "if", "while" or "for" */
+  T_sequence cond;  /* if and while: the condition */
+  T_sequence body;  /* then, or do */
+  T_sequence other; /* else (an elif is an if alone in it), or 0 */
+  T_word name;      /* for NAME */
+  T_words words;    /* for NAME in WORDS, or 0 */
+};
+
 struct T_words
 {
   T_word word;
@@ -51,6 +73,7 @@ struct T_words
 struct T_word
 {
   char *s;
+  T_sequence subst; /* <( sequence ) or >( sequence ), s being "<(" or ">(" */
 };
 
 extern T_sequence new_sequence();
@@ -60,5 +83,15 @@ extern T_words new_words();
 extern T_word new_word();
 
 extern T_redir new_redir();
+extern T_control new_control();
+
+// Frees a node from new_*() (not what it points to)
+extern void del_sequence(T_sequence t);
+extern void del_pipeline(T_pipeline t);
+extern void del_command(T_command t);
+extern void del_words(T_words t);
+extern void del_word(T_word t);
+extern void del_redir(T_redir t);
+extern void del_control(T_control t);
 
 #endif
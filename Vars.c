@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "Vars.h"
+#include "error.h"
+
+extern char **environ;
+
+// One variable, chained off its hash bucket
+typedef struct Var
+{
+  char *name;
+  char *value;
+  int exported;
+  struct Var *next;
+} *Var;
+
+typedef struct
+{
+  Var *buckets;
+  int size;     // number of buckets, a power of 2
+  int len;      // number of variables
+  int exported; // number of exported variables
+  char **envp;  // cached environment, 0 when it needs rebuilding
+  char *envs;   // storage for the strings in envp
+} *VarsRep;
+
+static VarsRep vars = 0;
+
+// FNV-1a
+static unsigned hash(char *s, int n)
+{
+  unsigned h = 2166136261u;
+  for (int i = 0; i < n; i++)
+    h = (h ^ (unsigned char)s[i]) * 16777619u;
+  return h;
+}
+
+static void dirty()
+{
+  if (vars->envp)
+  {
+    free(vars->envp);
+    free(vars->envs);
+    vars->envp = 0;
+    vars->envs = 0;
+  }
+}
+
+static void grow()
+{
+  int size = vars->size * 2;
+  Var *buckets = calloc(size, sizeof(Var));
+  if (!buckets)
+    ERROR("calloc() failed");
+  for (int i = 0; i < vars->size; i++)
+    for (Var v = vars->buckets[i], next; v; v = next)
+    {
+      next = v->next;
+      unsigned h = hash(v->name, strlen(v->name)) & (size - 1);
+      v->next = buckets[h];
+      buckets[h] = v;
+    }
+  free(vars->buckets);
+  vars->buckets = buckets;
+  vars->size = size;
+}
+
+/**
+ * @brief Finds a variable by the first n characters of name, optionally creating it
+ */
+static Var find(char *name, int n, int create)
+{
+  unsigned h = hash(name, n);
+  for (Var v = vars->buckets[h & (vars->size - 1)]; v; v = v->next)
+    if (!strncmp(v->name, name, n) && !v->name[n])
+      return v;
+  if (!create)
+    return 0;
+  if (vars->len >= vars->size)
+  {
+    grow();
+  }
+  Var v = malloc(sizeof(*v));
+  if (!v)
+    ERROR("malloc() failed");
+  v->name = strndup(name, n);
+  v->value = strdup("");
+  v->exported = 0;
+  v->next = vars->buckets[h & (vars->size - 1)];
+  vars->buckets[h & (vars->size - 1)] = v;
+  vars->len++;
+  return v;
+}
+
+/**
+ * @brief Creates the table on first use, importing the shell's environment
+ */
+static void init()
+{
+  if (vars)
+    return;
+  vars = malloc(sizeof(*vars));
+  if (!vars)
+    ERROR("malloc() failed");
+  vars->size = 64;
+  vars->buckets = calloc(vars->size, sizeof(Var));
+  if (!vars->buckets)
+    ERROR("calloc() failed");
+  vars->len = 0;
+  vars->exported = 0;
+  vars->envp = 0;
+  vars->envs = 0;
+  for (char **e = environ; e && *e; e++)
+  {
+    char *eq = strchr(*e, '=');
+    if (!eq)
+      continue;
+    Var v = find(*e, eq - *e, 1);
+    free(v->value);
+    v->value = strdup(eq + 1);
+    if (!v->exported)
+      vars->exported++;
+    v->exported = 1;
+  }
+}
+
+extern char *getVar(char *name)
+{
+  init();
+  Var v = find(name, strlen(name), 0);
+  return v ? v->value : 0;
+}
+
+extern void setVar(char *name, char *value)
+{
+  init();
+  Var v = find(name, strlen(name), 1);
+  free(v->value);
+  v->value = strdup(value);
+  if (v->exported)
+    dirty();
+}
+
+extern void unsetVar(char *name)
+{
+  init();
+  int n = strlen(name);
+  for (Var *p = &vars->buckets[hash(name, n) & (vars->size - 1)]; *p; p = &(*p)->next)
+    if (!strcmp((*p)->name, name))
+    {
+      Var v = *p;
+      *p = v->next;
+      vars->len--;
+      if (v->exported)
+      {
+        vars->exported--;
+        dirty();
+      }
+      free(v->name);
+      free(v->value);
+      free(v);
+      return;
+    }
+}
+
+extern void exportVar(char *name)
+{
+  init();
+  Var v = find(name, strlen(name), 1);
+  if (v->exported)
+    return;
+  v->exported = 1;
+  vars->exported++;
+  dirty();
+}
+
+extern int assignVar(char *s)
+{
+  if (!isalpha((unsigned char)*s) && *s != '_')
+    return 0;
+  char *p = s + 1;
+  while (isalnum((unsigned char)*p) || *p == '_')
+    p++;
+  return *p == '=' ? p - s : 0;
+}
+
+extern char *expandVars(char *s)
+{
+  if (!strchr(s, '$'))
+    return strdup(s);
+  init();
+  size_t len = 0, size = strlen(s) + 1;
+  char *t = malloc(size);
+  if (!t)
+    ERROR("malloc() failed");
+  while (*s)
+  {
+    char *name = 0, *value = 0;
+    int n = 0;
+    if (*s == '$' && s[1] == '{' && strchr(s, '}'))
+    {
+      // ${NAME}
+      name = s + 2;
+      n = strchr(s, '}') - name;
+      s = name + n + 1;
+    }
+    else if (*s == '$' && (isalpha((unsigned char)s[1]) || s[1] == '_'))
+    {
+      // $NAME
+      name = s + 1;
+      for (n = 1; isalnum((unsigned char)name[n]) || name[n] == '_'; n++)
+        ;
+      s = name + n;
+    }
+    if (name)
+    {
+      Var v = find(name, n, 0);
+      value = v ? v->value : "";
+    }
+    size_t m = value ? strlen(value) : 1;
+    if (len + m + 1 > size)
+    {
+      while (len + m + 1 > size)
+        size *= 2;
+      t = realloc(t, size);
+      if (!t)
+        ERROR("realloc() failed");
+    }
+    if (value)
+      memcpy(t + len, value, m);
+    else
+      t[len] = *s++;
+    len += m;
+  }
+  t[len] = 0;
+  return t;
+}
+
+extern char **envVars()
+{
+  init();
+  if (vars->envp)
+    return vars->envp;
+  // One array of pointers, one block for all the strings
+  size_t bytes = 0;
+  for (int i = 0; i < vars->size; i++)
+    for (Var v = vars->buckets[i]; v; v = v->next)
+      if (v->exported)
+        bytes += strlen(v->name) + strlen(v->value) + 2;
+  vars->envp = malloc(sizeof(char *) * (vars->exported + 1));
+  vars->envs = malloc(bytes + 1);
+  if (!vars->envp || !vars->envs)
+    ERROR("malloc() failed");
+  char *p = vars->envs;
+  int n = 0;
+  for (int i = 0; i < vars->size; i++)
+    for (Var v = vars->buckets[i]; v; v = v->next)
+      if (v->exported)
+      {
+        vars->envp[n++] = p;
+        p += sprintf(p, "%s=%s", v->name, v->value) + 1;
+      }
+  vars->envp[n] = 0;
+  return vars->envp;
+}
+
+extern void *swapVars(void *set)
+{
+  VarsRep old = vars;
+  vars = set;
+  return old;
+}
+
+extern void freeVars()
+{
+  if (!vars)
+    return;
+  dirty();
+  for (int i = 0; i < vars->size; i++)
+    for (Var v = vars->buckets[i], next; v; v = next)
+    {
+      next = v->next;
+      free(v->name);
+      free(v->value);
+      free(v);
+    }
+  free(vars->buckets);
+  free(vars);
+  vars = 0;
+}
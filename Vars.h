@@ -0,0 +1,88 @@
+#ifndef VARS_H
+#define VARS_H
+
+/**
+ * Shell variables, kept in a hash table keyed by name
+ *
+ * A variable is either local to the shell or exported. Exported variables
+ * make up the environment of every command the shell runs; the envp array
+ * for exec is cached and only rebuilt after an exported variable changes.
+ *
+ * The table starts out holding the shell's own environment, all exported.
+ */
+
+/**
+ * @brief Looks up a variable
+ * @param name Variable name
+ * @return Value of the variable, or NULL if it is not set
+ */
+extern char *getVar(char *name);
+
+/**
+ * @brief Sets a variable, creating it if needed
+ *
+ * An existing variable keeps its exported flag.
+ *
+ * @param name Variable name
+ * @param value New value (copied)
+ * @return VOID
+ */
+extern void setVar(char *name, char *value);
+
+/**
+ * @brief Removes a variable, if it is set
+ * @param name Variable name
+ * @return VOID
+ */
+extern void unsetVar(char *name);
+
+/**
+ * @brief Marks a variable as exported, creating it empty if needed
+ * @param name Variable name
+ * @return VOID
+ */
+extern void exportVar(char *name);
+
+/**
+ * @brief Checks if a word is an assignment (NAME=value)
+ * @param s Word to check
+ * @return Length of NAME if s is an assignment, 0 if not
+ */
+extern int assignVar(char *s);
+
+/**
+ * @brief Expands $NAME and ${NAME} in a word
+ * @param s Word to expand
+ * @return Newly allocated expanded word (caller must free)
+ */
+extern char *expandVars(char *s);
+
+/**
+ * @brief Gets the environment for exec
+ *
+ * The array is owned by the variable table and stays valid until the next
+ * change to an exported variable. Calling this in the shell before fork()
+ * means children share the cached array instead of each rebuilding it.
+ *
+ * @return NULL-terminated array of "NAME=value" strings
+ */
+extern char **envVars();
+
+/**
+ * @brief Frees the variable table and the cached environment
+ * @return VOID
+ */
+extern void freeVars();
+
+/**
+ * @brief Switches to another set of variables
+ *
+ * Lets several shell sessions in one process keep their own variables.
+ *
+ * @param set Variables returned by an earlier swapVars(), or NULL for a
+ *            new set (imported from the environment when first used)
+ * @return The set that was in use
+ */
+extern void *swapVars(void *set);
+
+#endif
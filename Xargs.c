@@ -0,0 +1,272 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memfd_create()
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "Xargs.h"
+#include "Command.h"
+#include "Vars.h"
+#include "Stats.h"
+#include "deq.h"
+#include "error.h"
+
+extern char **environ;
+
+// Left out of ARG_MAX for the kernel's own use, as xargs(1) does
+#define HEADROOM 2048
+// Longest single argument the kernel takes (MAX_ARG_STRLEN)
+#define MAXARG (32 * 4096)
+
+// A batch that has been started
+typedef struct
+{
+  int pid;
+  int out; // memory file holding its output (-k), or -1
+} *Batch;
+
+/**
+ * @brief Gets all of stdin in one buffer, with room for a NUL after it
+ *
+ * A regular file is mapped (privately, so items can be terminated in
+ * place), anything else is read.
+ *
+ * @param n Set to the number of bytes of input
+ * @param map Set to the mapping to munmap(), or 0 if the buffer was malloc()ed
+ * @param maplen Set to the length of the mapping
+ * @return The input
+ */
+static char *slurp(size_t *n, char **map, size_t *maplen)
+{
+  struct stat st;
+  *map = 0;
+  off_t at = lseek(STDIN_FILENO, 0, SEEK_CUR);
+  // The NUL after the file goes in the rest of its last page, so that has to exist
+  if (!fstat(STDIN_FILENO, &st) && S_ISREG(st.st_mode) && at >= 0 && at < st.st_size &&
+      st.st_size % sysconf(_SC_PAGESIZE))
+  {
+    char *m = mmap(0, st.st_size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, STDIN_FILENO, 0);
+    if (m != MAP_FAILED)
+    {
+      lseek(STDIN_FILENO, 0, SEEK_END);
+      *map = m;
+      *maplen = st.st_size + 1;
+      *n = st.st_size - at;
+      return m + at;
+    }
+  }
+  size_t len = 0, size = 1 << 16;
+  char *buf = malloc(size);
+  if (!buf)
+    ERROR("malloc() failed");
+  ssize_t r;
+  while ((r = read(STDIN_FILENO, buf + len, size - len - 1)) > 0)
+  {
+    len += r;
+    if (size - len - 1 == 0)
+    {
+      size *= 2;
+      buf = realloc(buf, size);
+      if (!buf)
+        ERROR("realloc() failed");
+    }
+  }
+  *n = len;
+  return buf;
+}
+
+/**
+ * @brief Splits the input into items, in place
+ * @param nitems Set to the number of items
+ * @return Items, pointing into buf
+ */
+static char **split(char *buf, size_t n, int nul, int *nitems)
+{
+  int k = 0, size = 1024;
+  char **items = malloc(sizeof(char *) * size);
+  if (!items)
+    ERROR("malloc() failed");
+  buf[n] = 0;
+  for (char *p = buf, *end = buf + n; p < end;)
+  {
+    if (!nul)
+      while (p < end && strchr(" \t\n", *p))
+        p++;
+    if (p == end)
+      break;
+    char *q = p;
+    if (nul)
+      q += strlen(q);
+    else
+      while (q < end && !strchr(" \t\n", *q))
+        q++;
+    *q = 0;
+    if (k == size)
+    {
+      size *= 2;
+      items = realloc(items, sizeof(char *) * size);
+      if (!items)
+        ERROR("realloc() failed");
+    }
+    items[k++] = p;
+    p = q + 1;
+  }
+  *nitems = k;
+  return items;
+}
+
+/**
+ * @brief Copies a batch's saved output to stdout
+ */
+static void drain(int fd)
+{
+  off_t off = 0;
+  ssize_t r;
+  while ((r = sendfile(STDOUT_FILENO, fd, &off, 1 << 20)) > 0)
+    ;
+  if (r == -1)
+  {
+    // stdout this kernel can't sendfile() to
+    char buf[1 << 16];
+    lseek(fd, off, SEEK_SET);
+    while ((r = read(fd, buf, sizeof(buf))) > 0)
+      if (write(STDOUT_FILENO, buf, r) != r)
+        break;
+  }
+  close(fd);
+}
+
+/**
+ * @brief Waits for the oldest running batch
+ * @return Its exit status
+ */
+static int finish(Deq running)
+{
+  Batch b = deq_head_get(running);
+  int status = waitCommand(b->pid);
+  if (b->out != -1)
+    drain(b->out);
+  free(b);
+  return status;
+}
+
+/**
+ * @brief Starts one batch
+ */
+static void start(char **argv, int keep, Deq running)
+{
+  Batch b = malloc(sizeof(*b));
+  if (!b)
+    ERROR("malloc() failed");
+  b->out = keep ? memfd_create("xargs", MFD_CLOEXEC) : -1;
+  if (keep && b->out == -1)
+    ERROR("memfd_create() failed");
+  b->pid = fork();
+  if (b->pid == -1)
+    ERROR("fork() failed");
+  if (!b->pid)
+  {
+    if (keep && dup2(b->out, STDOUT_FILENO) == -1)
+      _exit(127);
+    environ = envVars();
+    execvp(argv[0], argv);
+    countStats(ST_EXECFAIL);
+    ERRORLOC(__FILE__, __LINE__, "error", "%s: execvp() failed", argv[0]);
+    _exit(127);
+  }
+  forkStats(b->pid);
+  deq_tail_put(running, b);
+}
+
+extern int runXargs(char **argv)
+{
+  int nul = 0, keep = 0;
+  long max = 0, procs = 1;
+  char **a = argv + 1;
+  for (; *a && **a == '-'; a++)
+  {
+    if (!strcmp(*a, "-0"))
+      nul = 1;
+    else if (!strcmp(*a, "-k"))
+      keep = 1;
+    else if (!strcmp(*a, "-n") && a[1] && (max = atol(a[1])) > 0)
+      a++;
+    else if (!strcmp(*a, "-P") && a[1] && (procs = atol(a[1])) >= 0)
+      a++;
+    else
+    {
+      ERRORLOC(__FILE__, __LINE__, "error", "%s", "usage: xargs [-0] [-n N] [-P N] [-k] [command [args...]]");
+      return 1;
+    }
+  }
+  if (!procs)
+    procs = sysconf(_SC_NPROCESSORS_ONLN);
+  static char *echo[] = {"echo", 0};
+  char **cmd = *a ? a : echo;
+  int ncmd = 0;
+
+  // Room for arguments: ARG_MAX, less the environment and the command itself
+  long room = sysconf(_SC_ARG_MAX) - HEADROOM;
+  for (char **e = envVars(); *e; e++)
+    room -= strlen(*e) + 1 + sizeof(char *);
+  for (; cmd[ncmd]; ncmd++)
+    room -= strlen(cmd[ncmd]) + 1 + sizeof(char *);
+
+  size_t n, maplen;
+  char *map;
+  char *buf = slurp(&n, &map, &maplen);
+  int nitems;
+  char **items = split(buf, n, nul, &nitems);
+
+  // One argv, refilled for each batch
+  char **args = malloc(sizeof(char *) * (ncmd + nitems + 1));
+  if (!args)
+    ERROR("malloc() failed");
+  memcpy(args, cmd, sizeof(char *) * ncmd);
+
+  fflush(stdout);
+  Deq running = deq_new();
+  int status = 0;
+  int i = 0;
+  do
+  {
+    int k = ncmd;
+    long left = room;
+    for (; i < nitems && (!max || k - ncmd < max); i++)
+    {
+      long cost = strlen(items[i]) + 1 + sizeof(char *);
+      if (cost > MAXARG || (k > ncmd && cost > left))
+        break;
+      left -= cost;
+      args[k++] = items[i];
+    }
+    if (k == ncmd && i < nitems)
+    {
+      ERRORLOC(__FILE__, __LINE__, "error", "%s", "xargs: argument too long");
+      status = 1;
+      break;
+    }
+    args[k] = 0;
+    if (deq_len(running) >= procs && finish(running))
+      status = 123;
+    start(args, keep, running);
+  } while (i < nitems);
+  while (deq_len(running))
+    if (finish(running))
+      status = 123;
+
+  deq_del(running, 0);
+  free(items);
+  free(args);
+  if (map)
+    munmap(map, maplen);
+  else
+    free(buf);
+  return status;
+}
@@ -0,0 +1,26 @@
+#ifndef XARGS_H
+#define XARGS_H
+
+/**
+ * Builds command lines from stdin and runs them: the xargs builtin
+ *
+ *   xargs [-0] [-n N] [-P N] [-k] [command [args...]]
+ *
+ * Items are separated by blanks and newlines, or by NUL bytes with -0.
+ * stdin is read (or, for a file, mapped) once and the items are used in
+ * place as arguments, never copied. Each batch holds as many items as
+ * fit in sysconf(_SC_ARG_MAX) after the environment and the command's
+ * own arguments, or N with -n. Up to N batches run at once with -P (0
+ * means one per CPU); with -k their output is kept in memory files and
+ * written out in batch order, otherwise it is interleaved as produced.
+ * The command (echo by default) is run even if there are no items.
+ */
+
+/**
+ * @brief Runs xargs with the given arguments, reading items from stdin
+ * @param argv Arguments, argv[0] is "xargs"
+ * @return 0 if every batch exited 0, 123 if any failed, 1 on a usage error
+ */
+extern int runXargs(char **argv);
+
+#endif
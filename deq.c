@@ -3,6 +3,8 @@
 #include <string.h>
 
 #include "deq.h"
+#define ALLOC_MODULE AL_DEQ
+#include "Alloc.h"
 #include "error.h"
 
 // indices and size of array of node pointers
@@ -46,8 +48,8 @@ static Rep rep(Deq q)
  */
 static Node new_node(Data d)
 {
-  // Allocating Memory for new node
-  Node n = (Node)malloc(sizeof(*n));
+  // Allocating Memory for new node, recycled from freed ones (see Alloc.h)
+  Node n = (Node)newAlloc(AL_DEQ, sizeof(*n));
   if (!n)
   {
     ERROR("Malloc failed");
@@ -172,7 +174,7 @@ static Data get(Rep r, End e)
   r->len -= 1;
   // Free node removed
   Data result = returnNode->data;
-  free(returnNode);
+  freeAlloc(returnNode, sizeof(*returnNode));
   return result;
 }
 
@@ -218,7 +220,7 @@ static Data rem(Rep r, End e, Data d)
       // Setting the currentNode next to be its prev
       currentNode->np[Tail]->np[Head] = currentNode->np[Head];
       // Free node removed
-      free(currentNode);
+      freeAlloc(currentNode, sizeof(*currentNode));
       // Decrement the length of Queue
       r->len -= 1;
       return currentNodeData;
@@ -254,7 +256,7 @@ static Data rem(Rep r, End e, Data d)
  */
 extern Deq deq_new()
 {
-  Rep r = (Rep)malloc(sizeof(*r));
+  Rep r = (Rep)newAlloc(AL_DEQ, sizeof(*r));
   if (!r)
     ERROR("malloc() failed");
   r->ht[Head] = 0;
@@ -296,10 +298,10 @@ extern void deq_del(Deq q, DeqMapF f)
   while (curr)
   {
     Node next = curr->np[Tail];
-    free(curr);
+    freeAlloc(curr, sizeof(*curr));
     curr = next;
   }
-  free(q);
+  freeAlloc(q, sizeof(*rep(q)));
 }
 
 extern Str deq_str(Deq q, DeqStrF f)